@@ -5,7 +5,7 @@
 //  Created by Jean-Yves Hervé
 //	C++ version eevised 2023-04-12
 
-// g++ -Wall -std=c++20 main.cpp gl_frontEnd.cpp -framework OpenGL -framework GLUT -o travel
+// g++ -Wall -std=c++20 main.cpp gl_frontEnd.cpp spatialIndex.cpp frameCapture.cpp instrumentedMutex.cpp -framework OpenGL -framework GLUT -o travel
 
  /*-------------------------------------------------------------------------+
  |	A graphic front end for a grid+state simulation.						|
@@ -25,6 +25,15 @@
  |		- 'r' --> add red ink												|
  |		- 'g' --> add green ink												|
  |		- 'b' --> add blue ink												|
+ |		- left/right click in the grid --> zoom in/out						|
+ |		- drag in the grid --> pan, middle click --> whole grid				|
+ |																			|
+ |	With --headless, no window is opened: the simulation runs on its own	|
+ |	until --duration seconds or --steps traveler moves have elapsed.		|
+ |	In either mode, --frames <dir> records the grid every --frame-period	|
+ |	ms as PPM images, raw RGB frames or one RGB stream (--frame-format).	|
+ |	At exit, a table gives the counts and times of every mutex (see		|
+ |	instrumentedMutex.h, -DLOCK_STATS=0 to disable).						|
  +-------------------------------------------------------------------------*/
 
 #include <thread>
@@ -33,14 +42,20 @@
 #include <cstdlib>
 #include <ctime>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <iostream>
 #include <tuple>
-#include <fstream>
 #include <mutex>
+#include <chrono>
 #include <algorithm>
+#include <atomic>
 //
 #include "glPlatform.h"
 #include "gl_frontEnd.h"
+#include "frameCapture.h"
+#include "instrumentedMutex.h"
+#include "spatialIndex.h"
 
 using namespace std;
 
@@ -60,6 +75,11 @@ void colorTrailUp(TravelerInfo *traveler);
 void colorTrailDown(TravelerInfo *traveler);
 void colorTrailLeft(TravelerInfo *traveler);
 void colorTrailRight(TravelerInfo *traveler);
+bool claimCell(int row, int col, int id);
+void releaseCell(int row, int col);
+int reserveSegment(TravelerInfo *traveler, TravelDirection dir, int length);
+void travelersNear(int row, int col, int radius, std::vector<int>& ids);
+void travelersInRange(int rowMin, int colMin, int rowMax, int colMax, std::vector<int>& ids);
 
 void faster();
 void slower();
@@ -72,6 +92,11 @@ void producerGreenThreadFunc();
 void producerBlueThreadFunc();
 
 void readPipe(std::string pipePath);
+void handleCommand(std::string command);
+void applyPendingRefills(void);
+
+void runHeadless(void);
+void captureThreadFunc();
 
 std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection newDir, int newRow, int newCol);
 
@@ -79,6 +104,8 @@ std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection
 extern int	GRID_PANE, STATE_PANE;
 extern int	gMainWindow, gSubwindow[2];
 bool DRAW_COLORED_TRAVELER_HEADS = true;
+//	upper bound on the redraw rate; frames are only drawn when something changed
+int MAX_FPS = 100;
 
 //	The state grid and its dimensions
 int** grid;
@@ -109,15 +136,57 @@ std::vector<std::thread> producerRedThreads;
 std::vector<std::thread> producerGreenThreads;
 std::vector<std::thread> producerBlueThreads;
 
-std::mutex gridLock, travLocks, redInkLock, blueInkLock, greenInkLock, refillRedLock, refillBlueLock, refillGreenLock;
+//	they count how often and how long they are waited for and held, for the
+//	table printed by cleanupAndQuit
+InstrumentedMutex gridLock("grid");
+InstrumentedMutex redInkLock("redInk"), greenInkLock("greenInk"), blueInkLock("blueInk");
+InstrumentedMutex refillRedLock("refillRed"), refillGreenLock("refillGreen"), refillBlueLock("refillBlue");
 
 const int CORNER_DISTANCE = 1;
+
+//	cell reservations, one per grid square (see reserveSegment)
+std::atomic<int>* cellOwner;
+//	how many cells ahead a traveler reserves at once, and how many times it
+//	retries a blocked reservation before picking a new direction
+const int RESERVATION_LENGTH = 4;
+const int MAX_BLOCKED_TRIES = 50;
+
 unsigned int stime = 500000;
 
 random_device myRandDev;
 default_random_engine myEngine(myRandDev());
 
 std::string pipePath = "/tmp/travpipe";
+//	how long the pipe reader waits for a command before checking
+//	stopSimulation again (in milliseconds), and how much it reads at once
+const int PIPE_POLL_TIMEOUT = 100;
+const int PIPE_BUFFER_SIZE = 4096;
+//	refill commands whose ink doesn't fit in the tank yet.  Only the pipe reader
+//	touches these: it retries them every PIPE_RETRY_TIMEOUT ms while it waits
+//	for more commands, instead of spinning on a full tank and leaving the
+//	commands behind it unread
+int pendingRedRefills = 0, pendingGreenRefills = 0, pendingBlueRefills = 0;
+const int PIPE_RETRY_TIMEOUT = 1;
+
+//	set by cleanupAndQuit to get all simulation threads to return
+std::atomic<bool> stopSimulation(false);
+//	total number of cells traveled, all travelers included
+std::atomic<long> numMoves(0);
+
+//	headless mode: no GLUT window, stop after runDuration seconds or maxSteps
+//	moves (0 means no limit)
+bool headless = false;
+double runDuration = 0;
+long maxSteps = 0;
+//	frame capture: a snapshot of the grid every framePeriod ms goes into a
+//	queue of frameQueueSize buffers drained by the encoder thread
+std::string frameDir;
+int framePeriod = 100;
+CaptureFormat frameFormat = CAPTURE_PPM;
+int frameQueueSize = 8;
+std::thread captureThread;
+//	how often the headless main thread and the capture thread wake up (in microseconds)
+const int HEADLESS_POLL_TIME = 10000;
 //==================================================================================
 //	These are the functions that tie the simulation with the rendering.
 //	Some parts are "don't touch."  Other parts need your intervention
@@ -139,7 +208,7 @@ void displayGridPane(void)
 	//	You *must* synchronize this call.
 	//---------------------------------------------------------
 	//	Use this drawing call instead
-	drawGridAndTravelers(grid, num_rows, num_cols, travelerList);
+	drawGridAndTravelers(travelerList);
 
 	//	This is OpenGL/glut magic.  Don't touch
 	glutSwapBuffers();	
@@ -182,6 +251,7 @@ bool acquireRedInk(int theRed)
 	{
 		redLevel -= theRed;
 		ok = true;
+		markSimulationChanged();
 	}
 	redInkLock.unlock();
 	return ok;
@@ -195,6 +265,7 @@ bool acquireGreenInk(int theGreen)
 	{
 		greenLevel -= theGreen;
 		ok = true;
+		markSimulationChanged();
 	}
 	greenInkLock.unlock();
 	return ok;
@@ -208,6 +279,7 @@ bool acquireBlueInk(int theBlue)
 	{
 		blueLevel -= theBlue;
 		ok = true;
+		markSimulationChanged();
 	}
 	blueInkLock.unlock();
 	return ok;
@@ -227,6 +299,7 @@ bool refillRedInk(int theRed)
 	{
 		redLevel += theRed;
 		ok = true;
+		markSimulationChanged();
 	}
 	refillRedLock.unlock();
 	return ok;
@@ -240,6 +313,7 @@ bool refillGreenInk(int theGreen)
 	{
 		greenLevel += theGreen;
 		ok = true;
+		markSimulationChanged();
 	}
 	refillGreenLock.unlock();
 	return ok;
@@ -253,6 +327,7 @@ bool refillBlueInk(int theBlue)
 	{
 		blueLevel += theBlue;
 		ok = true;
+		markSimulationChanged();
 	}
 	refillBlueLock.unlock();
 	return ok;
@@ -286,39 +361,83 @@ void slowdownProducers(void)
 	producerSleepTime = (12 * producerSleepTime) / 10;
 }
 
+// read commands from the named pipe, one per line.  The pipe is opened once for
+// the whole run, read-write so that there always is a writer and read() never
+// reports end-of-file when a client closes its end.  Every complete line that
+// came in gets handled, so a burst of commands written at once is not lost.
 void readPipe(std::string pipe_path) 
 {
-	while (true) 
+	const int pipeFd = open(pipe_path.c_str(), O_RDWR | O_NONBLOCK);
+	if (pipeFd < 0)
 	{
-		std::ifstream pipeStream(pipe_path);
-		if (!pipeStream.is_open()) 
+		std::cerr << "Failed to open named pipe" << std::endl;
+		return;
+	}
+
+	struct pollfd pipePoll = {pipeFd, POLLIN, 0};
+	char buffer[PIPE_BUFFER_SIZE];
+	//	what came in after the last complete line
+	std::string pending;
+	while (!stopSimulation)
+	{
+		const bool refillsPending = pendingRedRefills + pendingGreenRefills + pendingBlueRefills > 0;
+		const int ready = poll(&pipePoll, 1, refillsPending ? PIPE_RETRY_TIMEOUT : PIPE_POLL_TIMEOUT);
+		if (ready <= 0)
 		{
-			std::cerr << "Failed to open named pipe" << std::endl;
-			return;
+			applyPendingRefills();
+			continue;
 		}
 
-		std::string command;
-		std::getline(pipeStream, command);
+		ssize_t count;
+		while ((count = read(pipeFd, buffer, sizeof(buffer))) > 0)
+			pending.append(buffer, count);
 
-		// TODO: Handle command
-		if (command == "r")
-		{
-			while(!refillRedInk(3 * MAX_ADD_INK));
-		}
-		else if (command == "g")
-		{
-			while(!refillGreenInk(3 * MAX_ADD_INK));
-		}
-		else if (command == "b")
-		{
-			while(!refillBlueInk(3 * MAX_ADD_INK));
-		}
-		else if (command == "end") 
+		size_t lineStart = 0, lineEnd;
+		while ((lineEnd = pending.find('\n', lineStart)) != std::string::npos)
 		{
-			exit(0);
+			handleCommand(pending.substr(lineStart, lineEnd - lineStart));
+			lineStart = lineEnd + 1;
 		}
-    }
-    // pipeStream.close();
+		pending.erase(0, lineStart);
+		applyPendingRefills();
+	}
+	close(pipeFd);
+}
+
+// carry out one command read from the pipe.  Refills are queued and go in as
+// soon as their tank has room for them (see applyPendingRefills)
+void handleCommand(std::string command)
+{
+	if (!command.empty() && command.back() == '\r')
+		command.pop_back();
+
+	if (command == "r")
+	{
+		pendingRedRefills++;
+	}
+	else if (command == "g")
+	{
+		pendingGreenRefills++;
+	}
+	else if (command == "b")
+	{
+		pendingBlueRefills++;
+	}
+	else if (command == "end") 
+	{
+		cleanupAndQuit();
+	}
+}
+
+// add the queued refills that fit in their tank now
+void applyPendingRefills(void)
+{
+	while (pendingRedRefills > 0 && refillRedInk(3 * MAX_ADD_INK))
+		pendingRedRefills--;
+	while (pendingGreenRefills > 0 && refillGreenInk(3 * MAX_ADD_INK))
+		pendingGreenRefills--;
+	while (pendingBlueRefills > 0 && refillBlueInk(3 * MAX_ADD_INK))
+		pendingBlueRefills--;
 }
 
 //------------------------------------------------------------------------
@@ -326,12 +445,45 @@ void readPipe(std::string pipe_path)
 //------------------------------------------------------------------------
 int main(int argc, char** argv)
 {
-    // Verify that three arguments were passed
-    if (argc != 4) 
+    // Verify that the positional arguments were passed, then parse the options
+    const std::string usage = std::string("Usage: ") + argv[0] + " <num_cols> <num_rows> <num_threads>"
+		" [--max-fps <n>]"
+		" [--headless [--duration <s>] [--steps <n>]]"
+		" [--frames <dir> [--frame-period <ms>] [--frame-format ppm|raw|stream] [--frame-queue <n>]]\n";
+    if (argc < 4) 
 	{
-        std::cerr << "Usage: " << argv[0] << " <num_cols> <num_rows> <num_threads>\n";
+        std::cerr << usage;
         return 1;
     }
+	for (int k = 4; k < argc; k++)
+	{
+		const std::string option = argv[k];
+		if (option == "--headless")
+			headless = true;
+		else if (option == "--max-fps" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			MAX_FPS = std::atoi(argv[++k]);
+		else if (option == "--duration" && k + 1 < argc)
+			runDuration = std::atof(argv[++k]);
+		else if (option == "--steps" && k + 1 < argc)
+			maxSteps = std::atol(argv[++k]);
+		else if (option == "--frames" && k + 1 < argc)
+			frameDir = argv[++k];
+		else if (option == "--frame-period" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			framePeriod = std::atoi(argv[++k]);
+		else if (option == "--frame-queue" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			frameQueueSize = std::atoi(argv[++k]);
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "ppm")
+			frameFormat = CAPTURE_PPM, k++;
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "raw")
+			frameFormat = CAPTURE_RAW, k++;
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "stream")
+			frameFormat = CAPTURE_STREAM, k++;
+		else
+		{
+			std::cerr << usage;
+			return 1;
+		}
+	}
 
     // Parse arguments and check for validity
     num_cols = std::atoi(argv[1]);
@@ -344,7 +496,8 @@ int main(int argc, char** argv)
         return 1;
     }
 
-	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+	if (!headless)
+		initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
 
 	//	Now we can do application-level
 	initializeApplication();
@@ -352,6 +505,11 @@ int main(int argc, char** argv)
     std::thread readerThread(readPipe, pipePath);
     // readerThread.join();
 
+	//	Without a window, the main thread just watches the simulation
+	//	until it's time to stop
+	if (headless)
+		runHeadless();
+
 	//	Now we enter the main loop of the program and to a large extend
 	//	"lose control" over its execution.  The callback functions that 
 	//	we set up earlier will be called when the corresponding event
@@ -378,15 +536,33 @@ void cleanupAndQuit()
 	//	You would want to join all the threads before you free the grid and other
 	//	allocated data structures.  You may run into seg-fault and other ugly termination
 	//	issues otherwise.
-	//  for (auto& t : threads) {
-	//  	t.join();
-	// }
-
-	//	just nicer.  Also, if you crash there, you know something is wrong
-	//	in your code.
-	for (int i=0; i< num_rows; i++)
-		delete []grid[i];
-	delete []grid;
+	//	The main thread (end of a headless run, keyboard) and the pipe reader
+	//	(end command) can both get here: only the first one cleans up, and the
+	//	other one waits for it to exit the process.
+	if (stopSimulation.exchange(true))
+	{
+		while (true)
+			pause();
+	}
+	for (auto& t : travelerThreads)
+		t.join();
+	for (int k = 0; k < (int) producerRedThreads.size(); k++)
+	{
+		producerRedThreads[k].join();
+		producerGreenThreads[k].join();
+		producerBlueThreads[k].join();
+	}
+	if (captureThread.joinable())
+	{
+		captureThread.join();
+		stopFrameCapture();
+		std::cout << "frames captured: " << capturedFrameCount()
+				  << ", dropped: " << droppedFrameCount() << std::endl;
+	}
+	std::cout << lockStatsTable();
+
+	//	The grid and what goes with it are left for exit() to reclaim: when we
+	//	get here from another thread, the GLUT thread may still be drawing them.
 	exit(0);
 	//	clear the traveler list
 	travelerList.clear();
@@ -398,6 +574,9 @@ void initializeApplication(void)
 	grid = new int*[num_rows];
 	for (int i=0; i<num_rows; i++)
 		grid[i] = new int[num_cols];
+	cellOwner = new std::atomic<int>[num_rows * num_cols];
+	initializeSpatialIndex(num_rows, num_cols);
+	setTravelerQueryFunc(travelersInRange);
 	
 	//---------------------------------------------------------------
 	//	The code block below to be replaced/removed
@@ -420,6 +599,8 @@ void initializeApplication(void)
 		}	
 	}
 
+	initializeGridRendering(grid, num_rows, num_cols);
+
 	//---------------------------------------------------------------
 	//	You're going to have to properly initialize your travelers at random locations
 	//	on the grid:
@@ -440,12 +621,15 @@ void initializeApplication(void)
 		producerGreenThreads.push_back(std::thread(producerGreenThreadFunc));
 		producerBlueThreads.push_back(std::thread(producerBlueThreadFunc));
     }
+
+	if (!frameDir.empty() && startFrameCapture(frameDir, frameFormat, num_rows, num_cols, frameQueueSize))
+		captureThread = std::thread(captureThreadFunc);
 }
 
 // add red ink to its tank
 void producerRedThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillRedInk(MAX_ADD_INK);
@@ -455,7 +639,7 @@ void producerRedThreadFunc()
 // add green ink to its tank
 void producerGreenThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillGreenInk(MAX_ADD_INK);
@@ -465,18 +649,58 @@ void producerGreenThreadFunc()
 // add blue ink to its tank
 void producerBlueThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillBlueInk(MAX_ADD_INK);
 	}
 }
 
+// main thread loop when running without a window
+void runHeadless(void)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	while (true)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		const double elapsed = std::chrono::duration<double>(now - start).count();
+
+		bool anyLive = false;
+		for (const TravelerInfo& traveler : travelerList)
+			anyLive = anyLive || traveler.isLive;
+
+		if (!anyLive || (runDuration > 0 && elapsed >= runDuration) || (maxSteps > 0 && numMoves >= maxSteps))
+		{
+			std::cout << "elapsed: " << elapsed << " s, moves: " << numMoves << std::endl;
+			break;
+		}
+		usleep(HEADLESS_POLL_TIME);
+	}
+	cleanupAndQuit();
+}
+
+// hand a snapshot of the grid to the encoder every framePeriod ms.  The copy
+// is all that happens here; a frame is dropped if the encoder is behind
+void captureThreadFunc()
+{
+	auto nextFrame = std::chrono::steady_clock::now();
+	while (!stopSimulation)
+	{
+		if (std::chrono::steady_clock::now() >= nextFrame)
+		{
+			captureFrame(grid);
+			nextFrame += std::chrono::milliseconds(framePeriod);
+		}
+		usleep(HEADLESS_POLL_TIME);
+	}
+}
+
 // function executed by each traveler thread
 void travelerThreadFunc(TravelerInfo *traveler) 
 {
 	
-	while (traveler->isLive)
+	while (traveler->isLive && !stopSimulation)
 	{
 		// random perpendicular direction
 		int currDir  = static_cast<int>(traveler->dir);
@@ -492,33 +716,58 @@ void travelerThreadFunc(TravelerInfo *traveler)
 		auto myTuple = getTargetCordinate(traveler, newDir, traveler->row, traveler->col);
 		int newRow = std::get<0>(myTuple);
 		int newCol = std::get<1>(myTuple);
-		
-		while (traveler->row != newRow) 
-		{
-			traveler->dir = newDir;
-			if (traveler->row < newRow)
-				colorTrailUp(traveler);
-
-			else if (traveler->row > newRow)
-				colorTrailDown(traveler);
-
-			usleep(stime);
-		}
+		int remaining = abs(newRow - traveler->row) + abs(newCol - traveler->col);
+		int blockedTries = 0;
 
-		while (traveler->col != newCol)
+		while (remaining > 0 && !stopSimulation)
 		{
-			traveler->dir = newDir;
-			if (traveler->col < newCol)
-				colorTrailLeft(traveler);
+			// reserve as much of the segment ahead as is free, then walk it
+			int reserved = reserveSegment(traveler, newDir, std::min(remaining, RESERVATION_LENGTH));
+			if (reserved == 0)
+			{
+				// someone is right in front of us: wait a bit, then give up on this segment
+				if (++blockedTries == MAX_BLOCKED_TRIES)
+					break;
+				usleep(1000);
+				continue;
+			}
+			blockedTries = 0;
 
-			else if (traveler->col > newCol)
-				colorTrailRight(traveler);
-
-			usleep(stime);
+			traveler->dir = newDir;
+			for (int k = 0; k < reserved; k++)
+			{
+				const int oldRow = traveler->row, oldCol = traveler->col;
+				switch (newDir)
+				{
+				case NORTH:
+					colorTrailDown(traveler);
+					break;
+				case SOUTH:
+					colorTrailUp(traveler);
+					break;
+				case WEST:
+					colorTrailRight(traveler);
+					break;
+				case EAST:
+					colorTrailLeft(traveler);
+					break;
+				default:
+					break;
+				}
+				spatialIndexMove(traveler->id, oldRow, oldCol, traveler->row, traveler->col);
+				numMoves++;
+				usleep(stime);
+			}
+			remaining -= reserved;
 		}
 		
 		if ((traveler->row == 0 && traveler->col == 0) || (traveler->row == 0 && traveler->col == num_cols - 1) || (traveler->row == num_rows - 1 && traveler->col == 0) || (traveler->row == num_rows - 1 && traveler->col == num_cols - 1))
-			traveler->isLive = false; 
+		{
+			traveler->isLive = false;
+			markSimulationChanged();
+			releaseCell(traveler->row, traveler->col);
+			spatialIndexRemove(traveler->id, traveler->row, traveler->col);
+		}
 	}
 }
 
@@ -531,24 +780,52 @@ void makeTravelers()
 		uniform_int_distribution<int> ttypes(0, NUM_TRAV_TYPES - 1);
 
 		traveler.type = (TravelerType) ttypes(myEngine);
-		traveler.isBlocked = false;
+		traveler.id = k;
+		std::vector<int> travelersAt;
 		do 
 		{
 			uniform_int_distribution<int> rowDist(CORNER_DISTANCE, num_rows-CORNER_DISTANCE);
 			traveler.row = rowDist(myEngine);
 			uniform_int_distribution<int> colDist(CORNER_DISTANCE, num_cols-CORNER_DISTANCE);
 			traveler.col = colDist(myEngine);
+			travelersAt.clear();
+			travelersNear(traveler.row, traveler.col, 0, travelersAt);
 		} 
-		while (std::find_if(travelerList.begin(), travelerList.end(), [&](const TravelerInfo& other) { return other.row == traveler.row && other.col == traveler.col; }) != travelerList.end());
+		while (!travelersAt.empty());
 
 		uniform_int_distribution<int> dirDist(0, NUM_TRAVEL_DIRECTIONS-1);
 		traveler.dir = static_cast<TravelDirection>(dirDist(myEngine));
 	
 		traveler.isLive = true;
 		travelerList.push_back(traveler);
+		claimCell(traveler.row, traveler.col, traveler.id);
+		spatialIndexInsert(traveler.id, traveler.row, traveler.col);
 	}
 }
 
+// ids of the live travelers within radius cells (Chebyshev distance) of a cell.
+void travelersNear(int row, int col, int radius, std::vector<int>& ids)
+{
+	travelersInRange(row - radius, col - radius, row + radius, col + radius, ids);
+}
+
+// ids of the live travelers in rows [rowMin, rowMax] and columns [colMin, colMax].
+// Only the tiles of the spatial index overlapping the area are looked at.
+void travelersInRange(int rowMin, int colMin, int rowMax, int colMax, std::vector<int>& ids)
+{
+	const size_t first = ids.size();
+	spatialIndexQuery(rowMin, colMin, rowMax, colMax, ids);
+
+	// a traveler crossing tiles can be listed twice
+	std::sort(ids.begin() + first, ids.end());
+	ids.erase(std::unique(ids.begin() + first, ids.end()), ids.end());
+	ids.erase(std::remove_if(ids.begin() + first, ids.end(), [&](int id)
+	{
+		const TravelerInfo& other = travelerList[id];
+		return !other.isLive || other.row < rowMin || other.row > rowMax || other.col < colMin || other.col > colMax;
+	}), ids.end());
+}
+
 // get the target position of the traveler coordinates based on its direction.
 std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection newDir, int newRow, int newCol) 
 {
@@ -584,22 +861,68 @@ std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection
 	return std::make_tuple(newRow, newCol);
 }
 
-void isOccupied(int row, int col)
-{	
-	for (int k = 0; k < num_threads; k++)
+// try to claim a single cell for the traveler with the given id.
+// a cell holds 0 when free, otherwise the id + 1 of the traveler owning it
+bool claimCell(int row, int col, int id)
+{
+	int expected = 0;
+	return cellOwner[row * num_cols + col].compare_exchange_strong(expected, id + 1, std::memory_order_acquire);
+}
+
+void releaseCell(int row, int col)
+{
+	cellOwner[row * num_cols + col].store(0, std::memory_order_release);
+}
+
+// try to reserve the next `length` cells ahead of the traveler in direction dir.
+// Claims are always taken in increasing cell index order, whichever way the traveler
+// heads, and never waited on, so two travelers can't deadlock over a shared run.
+// Returns the number of cells reserved, contiguous from the traveler's position;
+// anything claimed past the first taken cell is released right away.
+int reserveSegment(TravelerInfo *traveler, TravelDirection dir, int length)
+{
+	int dRow = 0, dCol = 0;
+	switch (dir)
+	{
+	case NORTH:
+		dRow = -1;
+		break;
+	case SOUTH:
+		dRow = 1;
+		break;
+	case WEST:
+		dCol = -1;
+		break;
+	case EAST:
+		dCol = 1;
+		break;
+	default:
+		break;
+	}
+	const int row = traveler->row, col = traveler->col;
+
+	// heading towards higher indices: the canonical order is the travel order
+	if (dRow + dCol > 0)
+	{
+		int reserved = 0;
+		while (reserved < length && claimCell(row + (reserved + 1) * dRow, col + (reserved + 1) * dCol, traveler->id))
+			reserved++;
+		return reserved;
+	}
+
+	// heading towards lower indices: claim from the far end back to the traveler,
+	// and drop what lies beyond a cell that someone else holds
+	int reserved = length;
+	for (int k = length; k >= 1; k--)
 	{
-		travLocks.lock();
-		while (travelerList[k].row == row && travelerList[k].col == col && travelerList[k].isLive)
+		if (!claimCell(row + k * dRow, col + k * dCol, traveler->id))
 		{
-			travLocks.unlock();
-			travelerList[k].isBlocked = true;
-			usleep(1000);
+			for (int j = k + 1; j <= reserved; j++)
+				releaseCell(row + j * dRow, col + j * dCol);
+			reserved = k - 1;
 		}
-		if (!(travelerList[k].isBlocked))
-			travLocks.unlock();
-
-		travelerList[k].isBlocked = false;
 	}
+	return reserved;
 }
 
 // updates the traveler left and leave a color trail right
@@ -609,9 +932,7 @@ void colorTrailRight(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while(!acquireRedInk(1)) usleep(1000);
-		
-		isOccupied(traveler->row, traveler->col - 1);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->col--;
 
@@ -619,12 +940,11 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 			
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | new_color;
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		break;
 	case GREEN_TRAV:
-		while(!acquireGreenInk(1)) usleep(1000);
-
-		isOccupied(traveler->row, traveler->col - 1);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->col--;
 
@@ -632,12 +952,11 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | (new_color << 8);
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		break;
 	case BLUE_TRAV:
-		while(!acquireBlueInk(1)) usleep(1000);
-
-		isOccupied(traveler->row, traveler->col - 1);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->col--;
 
@@ -645,11 +964,15 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | (new_color << 16);
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		break;
 	default:
 		break;
 	}
+
+	//	the cell left behind is colored, we can hand it back
+	releaseCell(traveler->row, traveler->col + 1);
 }
 
 // updates the traveler right and leave a color trail left
@@ -659,9 +982,7 @@ void colorTrailLeft(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while(!acquireRedInk(1)) usleep(1000);
-
-		isOccupied(traveler->row, traveler->col + 1);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->col++;
 
@@ -669,11 +990,10 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | new_color;
+		markGridCellDirty(traveler->row, traveler->col - 1);
 		break;
 	case GREEN_TRAV:
-		while(!acquireGreenInk(1)) usleep(1000);
-
-		isOccupied(traveler->row, traveler->col + 1);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->col++;
 
@@ -681,12 +1001,11 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | (new_color << 8);
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		break;
 	case BLUE_TRAV:
-		while(!acquireBlueInk(1)) usleep(1000);
-
-		isOccupied(traveler->row, traveler->col + 1);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->col++;
 
@@ -694,11 +1013,15 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | (new_color << 16);
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		break;
 	default:
 		break;
 	}
+
+	//	the cell left behind is colored, we can hand it back
+	releaseCell(traveler->row, traveler->col - 1);
 }
 
 // updates the traveler down and leave a color trail up
@@ -708,9 +1031,7 @@ void colorTrailUp(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while(!acquireRedInk(1)) usleep(1000);
-		
-		isOccupied(traveler->row + 1, traveler->col);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->row++;
 
@@ -718,12 +1039,11 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 		
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | new_color;
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		break;
 	case GREEN_TRAV:
-		while(!acquireGreenInk(1)) usleep(1000);
-
-		isOccupied(traveler->row + 1, traveler->col);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->row++;
 
@@ -731,12 +1051,11 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | (new_color << 8);
+		markGridCellDirty(traveler->row - 1, traveler->col);
 		
 		break;
 	case BLUE_TRAV:
-		while(!acquireBlueInk(1)) usleep(1000);
-
-		isOccupied(traveler->row + 1, traveler->col);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->row++;
 
@@ -744,11 +1063,15 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | (new_color << 16);
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		break;
 	default:
 		break;
 	}
+
+	//	the cell left behind is colored, we can hand it back
+	releaseCell(traveler->row - 1, traveler->col);
 }
 
 // updates the traveler up and leave a color trail down
@@ -758,9 +1081,7 @@ void colorTrailDown(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while(!acquireRedInk(1)) usleep(1000);
-		
-		isOccupied(traveler->row - 1, traveler->col);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->row--;
 
@@ -768,12 +1089,11 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 		
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | new_color;
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		break;
 	case GREEN_TRAV:
-		while(!acquireGreenInk(1)) usleep(1000);
-		
-		isOccupied(traveler->row - 1, traveler->col);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->row--;
 
@@ -781,12 +1101,11 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | (new_color << 8);
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		break;
 	case BLUE_TRAV:
-		while(!acquireBlueInk(1)) usleep(1000);
-		
-		isOccupied(traveler->row - 1, traveler->col);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 
 		traveler->row--;
 
@@ -794,9 +1113,13 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | (new_color << 16);
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		break;
 	default:
 		break;
 	}
+
+	//	the cell left behind is colored, we can hand it back
+	releaseCell(traveler->row + 1, traveler->col);
 }
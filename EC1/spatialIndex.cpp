@@ -0,0 +1,89 @@
+//
+//  spatialIndex.cpp
+//
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+//
+#include "spatialIndex.h"
+
+using namespace std;
+
+//---------------------------------------------------------------------------
+//  File-level global variables
+//---------------------------------------------------------------------------
+
+struct SpatialBucket {
+						std::mutex lock;
+						std::vector<int> ids;
+};
+
+SpatialBucket* spatialBuckets = nullptr;
+int numTileRows = 0, numTileCols = 0;
+
+//---------------------------------------------------------------------------
+//	Index functions
+//---------------------------------------------------------------------------
+
+static SpatialBucket& bucketAt(int row, int col)
+{
+	return spatialBuckets[(row / SPATIAL_TILE_SIZE) * numTileCols + col / SPATIAL_TILE_SIZE];
+}
+
+void initializeSpatialIndex(int numRows, int numCols)
+{
+	numTileRows = (numRows + SPATIAL_TILE_SIZE - 1) / SPATIAL_TILE_SIZE;
+	numTileCols = (numCols + SPATIAL_TILE_SIZE - 1) / SPATIAL_TILE_SIZE;
+	spatialBuckets = new SpatialBucket[numTileRows * numTileCols];
+}
+
+void spatialIndexInsert(int id, int row, int col)
+{
+	SpatialBucket& bucket = bucketAt(row, col);
+	lock_guard<mutex> guard(bucket.lock);
+	bucket.ids.push_back(id);
+}
+
+void spatialIndexRemove(int id, int row, int col)
+{
+	SpatialBucket& bucket = bucketAt(row, col);
+	lock_guard<mutex> guard(bucket.lock);
+	auto it = find(bucket.ids.begin(), bucket.ids.end(), id);
+	if (it != bucket.ids.end())
+	{
+		//	order within a bucket doesn't matter
+		*it = bucket.ids.back();
+		bucket.ids.pop_back();
+	}
+}
+
+void spatialIndexMove(int id, int oldRow, int oldCol, int newRow, int newCol)
+{
+	if (oldRow / SPATIAL_TILE_SIZE == newRow / SPATIAL_TILE_SIZE &&
+		oldCol / SPATIAL_TILE_SIZE == newCol / SPATIAL_TILE_SIZE)
+		return;
+
+	//	insert before removing, so that a concurrent query may briefly see the
+	//	traveler twice but never miss it
+	spatialIndexInsert(id, newRow, newCol);
+	spatialIndexRemove(id, oldRow, oldCol);
+}
+
+void spatialIndexQuery(int rowMin, int colMin, int rowMax, int colMax, std::vector<int>& ids)
+{
+	const int	tileRowMin = max(rowMin, 0) / SPATIAL_TILE_SIZE,
+				tileColMin = max(colMin, 0) / SPATIAL_TILE_SIZE,
+				tileRowMax = min(rowMax / SPATIAL_TILE_SIZE, numTileRows - 1),
+				tileColMax = min(colMax / SPATIAL_TILE_SIZE, numTileCols - 1);
+
+	for (int i=tileRowMin; i<=tileRowMax; i++)
+	{
+		for (int j=tileColMin; j<=tileColMax; j++)
+		{
+			SpatialBucket& bucket = spatialBuckets[i * numTileCols + j];
+			lock_guard<mutex> guard(bucket.lock);
+			ids.insert(ids.end(), bucket.ids.begin(), bucket.ids.end());
+		}
+	}
+}
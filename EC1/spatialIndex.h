@@ -0,0 +1,32 @@
+//
+//  spatialIndex.h
+//
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//	A uniform bucket grid over the cell grid.  Each bucket covers a
+//	SPATIAL_TILE_SIZE x SPATIAL_TILE_SIZE block of cells and keeps the ids of
+//	the travelers currently in it, so that "who is near this cell" only looks
+//	at the buckets overlapping the area instead of the whole traveler list.
+//
+//	Travelers only need to report when they cross from one tile into another.
+//	Each bucket has its own lock and no call ever holds two of them.
+//-----------------------------------------------------------------------------
+
+const int SPATIAL_TILE_SIZE = 16;
+
+void initializeSpatialIndex(int numRows, int numCols);
+void spatialIndexInsert(int id, int row, int col);
+void spatialIndexRemove(int id, int row, int col);
+void spatialIndexMove(int id, int oldRow, int oldCol, int newRow, int newCol);
+
+//	Appends to ids the travelers in every tile overlapping rows [rowMin, rowMax]
+//	and columns [colMin, colMax] (inclusive).  These are candidates: callers that
+//	need exact positions check them against the traveler itself.
+void spatialIndexQuery(int rowMin, int colMin, int rowMax, int colMax, std::vector<int>& ids);
+
+#endif // SPATIAL_INDEX_H
@@ -10,8 +10,17 @@ do
     cd "$version"
     
     # Build the executable
-    g++ -Wall -std=c++20 main.cpp gl_frontEnd.cpp -framework OpenGL -framework GLUT -o travel
+    g++ -Wall -std=c++20 *.cpp -framework OpenGL -framework GLUT -o travel
     
     # Return to the root directory
     cd ..
 done
+
+# The supervisor relies on epoll and signalfd, so it only builds on Linux
+if [[ "$(uname)" == "Linux" ]]
+then
+    g++ -Wall -std=c++20 -IVersion2 Supervisor/main.cpp Version2/controlBlock.cpp Version2/commandScript.cpp -o travel-supervisor
+fi
+
+# The viewer of the grids published with --publish
+g++ -Wall -std=c++20 -IVersion2 Viewer/main.cpp Version2/gl_frontEnd.cpp Version2/sharedGrid.cpp -framework OpenGL -framework GLUT -o travel-viewer
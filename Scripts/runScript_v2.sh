@@ -25,8 +25,10 @@ trav() {
   rm -f $PIPE
   mkfifo $PIPE
   
-  # launch new process and get PID
-  ./Version2/travel $width $height $numThreads $PIPE &
+  # launch new process and get PID.  Controllers can also reach it through
+  # the shared-memory control block /travelN, and all processes at once
+  # through the broadcast slot /travel-broadcast (see controlBlock.h)
+  ./Version2/travel $width $height $numThreads $PIPE --control-shm /travel${numProcesses} --control-broadcast /travel-broadcast &
 
   # get the process ID of the last launched process
   PID=$!
@@ -0,0 +1,658 @@
+//
+//  main.cpp
+//  travel-supervisor
+//
+
+// g++ -Wall -std=c++20 -I../Version2 main.cpp ../Version2/controlBlock.cpp ../Version2/commandScript.cpp -o travel-supervisor
+
+ /*-------------------------------------------------------------------------+
+ |	Starts and controls a set of Version2 travel processes.					|
+ |																			|
+ |	Each process is started with posix_spawn and gets a named pipe and a	|
+ |	shared-memory control block (see controlBlock.h); all of them share a	|
+ |	broadcast slot.  The supervisor reads commands from stdin, sends them	|
+ |	through the control blocks, reaps the processes as they exit and		|
+ |	aggregates their published state.										|
+ |	With --zygote <socket>, processes are forked by a running				|
+ |	'travel --zygote <socket>' instead, and watched through pidfds.			|
+ |	With --shared-ink, all the processes draw from the same ink tanks.		|
+ |	With --publish, each process publishes its grid for travel-viewer as	|
+ |	/travel<supervisor pid>-grid<i>.										|
+ |	With --script <file>, the commands come from a script of timed			|
+ |	commands (see commandScript.h) instead of stdin.						|
+ |																			|
+ |	Commands:																|
+ |		- trav <width> <height> <threads> --> start a process				|
+ |		- domain <n> <width> <height> <threads> --> start n processes		|
+ |		  sharing one grid, each with a strip of it (see domain.h)			|
+ |		- <i> r|g|b --> add ink to process i (numbered from 1)				|
+ |		- <i> speed <us> | period <us> --> traveler/producer sleep time		|
+ |		- <i> spawn | kill <k> --> add a traveler / stop traveler k			|
+ |		- <i> end --> stop process i										|
+ |		- all <command> --> send a command to every process at once			|
+ |		- stats --> print the state of every process						|
+ |		- quit (or end of input) --> stop every process and exit			|
+ +-------------------------------------------------------------------------*/
+
+#if !defined(__linux__)
+	#error travel-supervisor relies on epoll and signalfd
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+//
+#include "controlBlock.h"
+#include "domain.h"
+#include "commandScript.h"
+
+extern char** environ;
+
+//==================================================================================
+//	Function prototypes
+//==================================================================================
+
+bool startChild(int width, int height, int numThreads, const std::vector<std::string>& extraArgs = {});
+void startDomain(int numPartitions, int width, int height, int numThreads);
+void handleLine(const std::string& line);
+void handleScriptLine(std::string line);
+bool parseRequest(std::istringstream& words, ControlRequest& request);
+void sendRequest(int index, ControlRequest request);
+void broadcastRequest(ControlRequest request);
+void flushPendingRequests(void);
+void checkAcks(void);
+void reapChildren(void);
+bool connectZygote(const std::string& path);
+pid_t forkFromZygote(const std::vector<std::string>& args);
+void childExited(size_t index, int exitStatus);
+void printStats(void);
+void endAll(void);
+
+//==================================================================================
+//	Global variables
+//==================================================================================
+
+struct Child {
+						pid_t pid;
+						std::string pipePath;
+						std::string shmName;
+						//	mapped once the process has created it
+						ControlBlock* block;
+						//	requests waiting for the block to show up or for room
+						//	in its ring
+						std::deque<ControlRequest> pending;
+						uint32_t nextSeq;
+						//	refusals of its requests reported so far, and lost
+						uint32_t numRefusalsSeen;
+						uint32_t numRefusalsLost;
+						//	-1 unless forked by the zygote
+						int pidFd;
+						bool isLive;
+						//	-1 if unknown (zygote children aren't ours to wait for)
+						int exitStatus;
+};
+
+std::vector<Child> children;
+int numLiveChildren = 0;
+
+std::string travelPath = "./Version2/travel";
+//	extra arguments given to every process (after -- on our command line)
+std::vector<std::string> childArgs;
+
+std::string broadcastName;
+BroadcastBlock* broadcastBlock = nullptr;
+//	shared-memory blocks of the domains started, removed when we exit
+std::vector<std::string> domainNames;
+//	ink tanks shared by every process, if --shared-ink
+std::string inkName;
+//	whether the processes publish their grid for travel-viewer
+bool publishGrids = false;
+//	commands replayed instead of reading stdin, if --script
+CommandScript commandScript;
+bool scriptRunning = false;
+
+//	ink added by r, g, b (what the pipe's text commands add)
+const int REFILL_AMOUNT = 30;
+//	how long the loop waits when requests are waiting on a process (in ms)
+const int PENDING_POLL_TIMEOUT = 1;
+const int IDLE_POLL_TIMEOUT = 100;
+
+bool quitting = false;
+int epollFd = -1;
+
+//	connection to the zygote, -1 when processes are started with posix_spawn
+int zygoteFd = -1;
+
+//==================================================================================
+//	Main
+//==================================================================================
+
+int main(int argc, char** argv)
+{
+	const std::string usage = std::string("Usage: ") + argv[0] +
+		" [--travel <path> | --zygote <socket>] [--spawn <n> <width> <height> <threads>] [--shared-ink]"
+		" [--publish] [--script <file>] [-- <travel options>]\n";
+
+	int numInitial = 0, initialWidth = 0, initialHeight = 0, initialThreads = 0;
+	for (int k = 1; k < argc; k++)
+	{
+		const std::string option = argv[k];
+		if (option == "--travel" && k + 1 < argc)
+			travelPath = argv[++k];
+		else if (option == "--zygote" && k + 1 < argc)
+		{
+			if (!connectZygote(argv[++k]))
+			{
+				std::cerr << "Failed to connect to the zygote at " << argv[k] << std::endl;
+				return 1;
+			}
+		}
+		else if (option == "--spawn" && k + 4 < argc)
+		{
+			numInitial = std::atoi(argv[++k]);
+			initialWidth = std::atoi(argv[++k]);
+			initialHeight = std::atoi(argv[++k]);
+			initialThreads = std::atoi(argv[++k]);
+		}
+		else if (option == "--publish")
+			publishGrids = true;
+		else if (option == "--script" && k + 1 < argc)
+		{
+			if (!loadCommandScript(argv[++k], commandScript))
+				return 1;
+			scriptRunning = true;
+		}
+		else if (option == "--shared-ink")
+			inkName = "/travel" + std::to_string(getpid()) + "-ink";
+		else if (option == "--")
+		{
+			childArgs.assign(argv + k + 1, argv + argc);
+			break;
+		}
+		else
+		{
+			std::cerr << usage;
+			return 1;
+		}
+	}
+
+	broadcastName = "/travel" + std::to_string(getpid()) + "-broadcast";
+	broadcastBlock = mapBroadcastBlock(broadcastName.c_str());
+	if (broadcastBlock == nullptr)
+	{
+		std::cerr << "Failed to create broadcast block " << broadcastName << std::endl;
+		return 1;
+	}
+
+	//	SIGCHLD only gets delivered through the signalfd
+	sigset_t childSignal;
+	sigemptyset(&childSignal);
+	sigaddset(&childSignal, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &childSignal, nullptr);
+	const int signalFd = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = STDIN_FILENO;
+	if (!scriptRunning)
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, STDIN_FILENO, &event);
+	event.data.fd = signalFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+
+	for (int k = 0; k < numInitial; k++)
+		startChild(initialWidth, initialHeight, initialThreads);
+
+	//	what came in on stdin after the last complete line
+	std::string pending;
+	bool inputOpen = !scriptRunning;
+	startCommandScript(commandScript);
+	while (inputOpen || scriptRunning || numLiveChildren > 0)
+	{
+		//	the end of the script is the end of input
+		int timeout = -1;
+		if (scriptRunning && (timeout = runCommandScript(commandScript, handleScriptLine)) < 0)
+		{
+			scriptRunning = false;
+			quitting = true;
+		}
+
+		bool anyPending = false;
+		for (const Child& child : children)
+			anyPending = anyPending || (child.isLive && !child.pending.empty());
+		const int pollTimeout = anyPending ? PENDING_POLL_TIMEOUT : IDLE_POLL_TIMEOUT;
+		if (timeout < 0 || timeout > pollTimeout)
+			timeout = pollTimeout;
+
+		struct epoll_event events[16];
+		const int count = epoll_wait(epollFd, events, 16, timeout);
+		for (int e = 0; e < count; e++)
+		{
+			//	pidfds are registered with the index of their process + 1
+			if (events[e].data.u64 > (uint64_t) INT32_MAX)
+				childExited(events[e].data.u64 - INT32_MAX - 1, -1);
+			else if (events[e].data.fd == signalFd)
+			{
+				struct signalfd_siginfo info;
+				while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+					;
+				reapChildren();
+			}
+			else if (inputOpen)
+			{
+				char buffer[4096];
+				const ssize_t numRead = read(STDIN_FILENO, buffer, sizeof(buffer));
+				if (numRead > 0)
+					pending.append(buffer, numRead);
+				size_t lineStart = 0, lineEnd;
+				while ((lineEnd = pending.find('\n', lineStart)) != std::string::npos)
+				{
+					handleLine(pending.substr(lineStart, lineEnd - lineStart));
+					lineStart = lineEnd + 1;
+				}
+				pending.erase(0, lineStart);
+
+				if (numRead <= 0 && errno != EINTR)
+				{
+					if (!pending.empty())
+						handleLine(pending);
+					epoll_ctl(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+					inputOpen = false;
+					quitting = true;
+				}
+			}
+		}
+
+		if (quitting)
+		{
+			endAll();
+			quitting = false;
+			inputOpen = false;
+		}
+		flushPendingRequests();
+		checkAcks();
+	}
+
+	printStats();
+	shm_unlink(broadcastName.c_str());
+	for (const std::string& name : domainNames)
+		shm_unlink(name.c_str());
+	if (!inkName.empty())
+		shm_unlink(inkName.c_str());
+	return 0;
+}
+
+//==================================================================================
+//	Processes
+//==================================================================================
+
+// start a travel process with its own pipe and control block
+bool startChild(int width, int height, int numThreads, const std::vector<std::string>& extraArgs)
+{
+	const int index = children.size() + 1;
+	Child child;
+	child.pipePath = "/tmp/travpipe" + std::to_string(index);
+	child.shmName = "/travel" + std::to_string(getpid()) + "-" + std::to_string(index);
+	child.block = nullptr;
+	child.pidFd = -1;
+	child.nextSeq = 1;
+	child.numRefusalsSeen = 0;
+	child.numRefusalsLost = 0;
+	child.isLive = false;
+	child.exitStatus = 0;
+
+	unlink(child.pipePath.c_str());
+	mkfifo(child.pipePath.c_str(), 0600);
+
+	std::vector<std::string> args = {travelPath, std::to_string(width), std::to_string(height),
+									 std::to_string(numThreads), child.pipePath,
+									 "--control-shm", child.shmName, "--control-broadcast", broadcastName};
+	args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+	if (!inkName.empty())
+		args.insert(args.end(), {"--shared-ink", inkName});
+	const std::string gridName = "/travel" + std::to_string(getpid()) + "-grid" + std::to_string(index);
+	if (publishGrids)
+		args.insert(args.end(), {"--publish", gridName});
+	args.insert(args.end(), childArgs.begin(), childArgs.end());
+	std::vector<char*> argv;
+	for (std::string& arg : args)
+		argv.push_back(&arg[0]);
+	argv.push_back(nullptr);
+
+	if (zygoteFd >= 0)
+	{
+		child.pid = forkFromZygote(args);
+		if (child.pid > 0)
+			child.pidFd = syscall(SYS_pidfd_open, child.pid, 0);
+		if (child.pid <= 0 || child.pidFd < 0)
+		{
+			std::cerr << "The zygote failed to start a process" << std::endl;
+			unlink(child.pipePath.c_str());
+			return false;
+		}
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u64 = (uint64_t) INT32_MAX + 1 + children.size();
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, child.pidFd, &event);
+		child.isLive = true;
+		numLiveChildren++;
+		children.push_back(child);
+		std::cout << "process " << index << " forked (pid " << child.pid << ")"
+				  << (publishGrids ? ", grid " + gridName : "") << std::endl;
+		return true;
+	}
+
+	//	the process gets the default signal mask back, SIGCHLD included
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	sigset_t noSignals;
+	sigemptyset(&noSignals);
+	posix_spawnattr_setsigmask(&attributes, &noSignals);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+	const int error = posix_spawn(&child.pid, travelPath.c_str(), nullptr, &attributes, argv.data(), environ);
+	posix_spawnattr_destroy(&attributes);
+	if (error != 0)
+	{
+		std::cerr << "Failed to start " << travelPath << ": " << strerror(error) << std::endl;
+		unlink(child.pipePath.c_str());
+		return false;
+	}
+
+	child.isLive = true;
+	numLiveChildren++;
+	children.push_back(child);
+	std::cout << "process " << index << " started (pid " << child.pid << ")"
+			  << (publishGrids ? ", grid " + gridName : "") << std::endl;
+	return true;
+}
+
+// start the processes of a domain: one per strip of a width x height grid,
+// each with numThreads travelers of its own to begin with
+void startDomain(int numPartitions, int width, int height, int numThreads)
+{
+	const std::string name = "/travel" + std::to_string(getpid()) + "-domain" + std::to_string(domainNames.size() + 1);
+	domainNames.push_back(name);
+	for (int k = 0; k < numPartitions; k++)
+		startChild(width, height, numThreads, {"--domain", name, "--partition", std::to_string(k) + "/" + std::to_string(numPartitions)});
+}
+
+// collect every process that exited
+void reapChildren(void)
+{
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		for (size_t k = 0; k < children.size(); k++)
+			if (children[k].pid == pid && children[k].isLive)
+				childExited(k, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	}
+}
+
+// forget about a process that has exited
+void childExited(size_t index, int exitStatus)
+{
+	Child& child = children[index];
+	if (!child.isLive)
+		return;
+	child.isLive = false;
+	child.exitStatus = exitStatus;
+	child.pending.clear();
+	if (child.block != nullptr)
+		unmapControlBlock(child.block, child.shmName.c_str(), false);
+	child.block = nullptr;
+	if (child.pidFd >= 0)
+	{
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, child.pidFd, nullptr);
+		close(child.pidFd);
+		child.pidFd = -1;
+	}
+	numLiveChildren--;
+	unlink(child.pipePath.c_str());
+	std::cout << "process " << index + 1 << " (pid " << child.pid << ") exited";
+	if (exitStatus >= 0)
+		std::cout << " with status " << exitStatus;
+	std::cout << std::endl;
+}
+
+//==================================================================================
+//	Zygote
+//==================================================================================
+
+bool connectZygote(const std::string& path)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	if (path.size() >= sizeof(address.sun_path))
+		return false;
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path.c_str());
+
+	zygoteFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (zygoteFd < 0 || connect(zygoteFd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		close(zygoteFd);
+		zygoteFd = -1;
+		return false;
+	}
+	return true;
+}
+
+// asks the zygote for a process running with these arguments (args[0], the
+// program, is left out) and returns its pid, or -1
+pid_t forkFromZygote(const std::vector<std::string>& args)
+{
+	std::string request;
+	for (size_t k = 1; k < args.size(); k++)
+		request += args[k] + (k + 1 < args.size() ? " " : "\n");
+	if (write(zygoteFd, request.data(), request.size()) != (ssize_t) request.size())
+		return -1;
+
+	//	the reply is a single line
+	std::string reply;
+	char c;
+	while (read(zygoteFd, &c, 1) == 1 && c != '\n')
+		reply += c;
+	return reply.empty() || reply.compare(0, 5, "error") == 0 ? -1 : std::atoi(reply.c_str());
+}
+
+//==================================================================================
+//	Commands
+//==================================================================================
+
+void handleScriptLine(std::string line)
+{
+	handleLine(line);
+}
+
+void handleLine(const std::string& line)
+{
+	std::istringstream words(line);
+	std::string first;
+	if (!(words >> first))
+		return;
+
+	if (first == "trav")
+	{
+		int width, height, numThreads;
+		if (words >> width >> height >> numThreads && width > 1 && height > 1 && numThreads > 0)
+			startChild(width, height, numThreads);
+		else
+			std::cout << "Invalid command: " << line << std::endl;
+	}
+	else if (first == "domain")
+	{
+		int numPartitions, width, height, numThreads;
+		if (words >> numPartitions >> width >> height >> numThreads && numPartitions > 0 && numPartitions <= MAX_DOMAIN_PARTITIONS
+			&& width > 1 && height >= 2 * numPartitions && numThreads > 0)
+			startDomain(numPartitions, width, height, numThreads);
+		else
+			std::cout << "Invalid command: " << line << std::endl;
+	}
+	else if (first == "stats")
+		printStats();
+	else if (first == "quit")
+		quitting = true;
+	else
+	{
+		ControlRequest request;
+		const int index = first == "all" ? 0 : std::atoi(first.c_str());
+		if ((first != "all" && (index < 1 || index > (int) children.size())) || !parseRequest(words, request))
+			std::cout << "Invalid command: " << line << std::endl;
+		else if (index == 0)
+			broadcastRequest(request);
+		else
+			sendRequest(index, request);
+	}
+}
+
+// turns the rest of a command line into a request
+bool parseRequest(std::istringstream& words, ControlRequest& request)
+{
+	memset(&request, 0, sizeof(request));
+	request.header.length = sizeof(ControlRequest);
+
+	std::string command;
+	if (!(words >> command))
+		return false;
+	if (command == "r" || command == "g" || command == "b")
+	{
+		request.header.op = CONTROL_REFILL;
+		request.args[0] = command == "r" ? 0 : command == "g" ? 1 : 2;
+		request.args[1] = REFILL_AMOUNT;
+	}
+	else if (command == "speed" && words >> request.args[0])
+		request.header.op = CONTROL_SET_TRAVELER_SPEED;
+	else if (command == "period" && words >> request.args[0])
+		request.header.op = CONTROL_SET_PRODUCER_PERIOD;
+	else if (command == "spawn")
+	{
+		request.header.op = CONTROL_SPAWN_TRAVELER;
+		request.args[0] = -1;
+	}
+	else if (command == "kill" && words >> request.args[0])
+		request.header.op = CONTROL_KILL_TRAVELER;
+	else if (command == "end")
+		request.header.op = CONTROL_END;
+	else
+		return false;
+	return true;
+}
+
+void sendRequest(int index, ControlRequest request)
+{
+	Child& child = children[index - 1];
+	if (!child.isLive)
+	{
+		std::cout << "process " << index << " has exited" << std::endl;
+		return;
+	}
+	request.header.seq = child.nextSeq++;
+	child.pending.push_back(request);
+	flushPendingRequests();
+}
+
+void broadcastRequest(ControlRequest request)
+{
+	broadcastControlRequest(broadcastBlock, request);
+}
+
+// moves the waiting requests into the rings of the processes' control blocks,
+// mapping the blocks of the processes that have created theirs since
+void flushPendingRequests(void)
+{
+	for (Child& child : children)
+	{
+		if (!child.isLive)
+			continue;
+		if (child.block == nullptr)
+			child.block = mapControlBlock(child.shmName.c_str(), false);
+		if (child.block == nullptr)
+			continue;
+		while (!child.pending.empty() && pushControlRequest(child.block, child.pending.front()))
+			child.pending.pop_front();
+	}
+}
+
+// reports requests the processes turned down
+void checkAcks(void)
+{
+	for (size_t k = 0; k < children.size(); k++)
+	{
+		Child& child = children[k];
+		if (!child.isLive || child.block == nullptr)
+			continue;
+		ControlRefusal refusal;
+		const uint32_t numLost = child.numRefusalsLost;
+		while (readControlRefusal(child.block, child.numRefusalsSeen, refusal, child.numRefusalsLost))
+		{
+			if (refusal.status == CONTROL_TANK_FULL)
+				std::cout << "process " << k + 1 << ": request " << refusal.seq << ": tank full" << std::endl;
+			else
+				std::cout << "process " << k + 1 << ": request " << refusal.seq << " refused (" << refusal.status << ")" << std::endl;
+		}
+		if (child.numRefusalsLost != numLost)
+			std::cout << "process " << k + 1 << ": " << child.numRefusalsLost - numLost << " more requests refused" << std::endl;
+	}
+}
+
+// stop every process that's still running.  Each one gets its own request
+// rather than a broadcast, which a process still starting up could miss
+void endAll(void)
+{
+	ControlRequest request;
+	memset(&request, 0, sizeof(request));
+	request.header.length = sizeof(ControlRequest);
+	request.header.op = CONTROL_END;
+	for (size_t k = 0; k < children.size(); k++)
+		if (children[k].isLive)
+			sendRequest(k + 1, request);
+}
+
+void printStats(void)
+{
+	long totalMoves = 0;
+	int totalTravelers = 0, totalLive = 0;
+	for (size_t k = 0; k < children.size(); k++)
+	{
+		const Child& child = children[k];
+		std::cout << "process " << k + 1 << " (pid " << child.pid << "): ";
+		if (!child.isLive && child.exitStatus < 0)
+			std::cout << "exited" << std::endl;
+		else if (!child.isLive)
+			std::cout << "exited with status " << child.exitStatus << std::endl;
+		else if (child.block == nullptr)
+			std::cout << "starting" << std::endl;
+		else
+		{
+			const ControlBlock* block = child.block;
+			std::cout << "travelers " << block->numLiveTravelers << "/" << block->numTravelers
+					  << ", ink " << block->redLevel << " " << block->greenLevel << " " << block->blueLevel
+					  << ", moves " << block->numMoves << std::endl;
+			totalMoves += block->numMoves;
+			totalTravelers += block->numTravelers;
+			totalLive += block->numLiveTravelers;
+		}
+	}
+	std::cout << "total: " << numLiveChildren << " running, travelers " << totalLive << "/"
+			  << totalTravelers << ", moves " << totalMoves << std::endl;
+}
@@ -0,0 +1,72 @@
+//
+//  instrumentedMutex.cpp
+//
+
+#include <sstream>
+#include <iomanip>
+//
+#include "instrumentedMutex.h"
+
+using namespace std;
+
+#if LOCK_STATS
+
+//	filled in by the constructors of the global mutexes
+InstrumentedMutex* instrumentedMutexes[MAX_INSTRUMENTED_MUTEXES];
+atomic<int> numInstrumentedMutexes(0);
+
+InstrumentedMutex::InstrumentedMutex(const char* lockName)
+	:	lockName(lockName)
+{
+	const int index = numInstrumentedMutexes.fetch_add(1);
+	if (index < MAX_INSTRUMENTED_MUTEXES)
+		instrumentedMutexes[index] = this;
+}
+
+string lockStatsTable(void)
+{
+	ostringstream table;
+	table << left << setw(14) << "lock" << right << setw(12) << "acquired" << setw(12) << "contended"
+		  << setw(12) << "wait ms" << setw(12) << "max wait" << setw(12) << "hold ms" << setw(12) << "max hold" << "\n"
+		  << fixed << setprecision(3);
+	const int count = min(numInstrumentedMutexes.load(), MAX_INSTRUMENTED_MUTEXES);
+	for (int k = 0; k < count; k++)
+	{
+		const InstrumentedMutex* mutex = instrumentedMutexes[k];
+		table << left << setw(14) << mutex->name() << right << setw(12) << mutex->acquisitions()
+			  << setw(12) << mutex->contended() << setw(12) << mutex->waitTime() / 1e6
+			  << setw(12) << mutex->maxWaitTime() / 1e6 << setw(12) << mutex->holdTime() / 1e6
+			  << setw(12) << mutex->maxHoldTime() / 1e6 << "\n";
+	}
+	return table.str();
+}
+
+string lockStatsJson(void)
+{
+	ostringstream json;
+	json << fixed << setprecision(3);
+	const int count = min(numInstrumentedMutexes.load(), MAX_INSTRUMENTED_MUTEXES);
+	for (int k = 0; k < count; k++)
+	{
+		const InstrumentedMutex* mutex = instrumentedMutexes[k];
+		json << (k > 0 ? "," : "") << "\"" << mutex->name() << "\":{\"acquired\":" << mutex->acquisitions()
+			 << ",\"contended\":" << mutex->contended() << ",\"waitMs\":" << mutex->waitTime() / 1e6
+			 << ",\"maxWaitMs\":" << mutex->maxWaitTime() / 1e6 << ",\"holdMs\":" << mutex->holdTime() / 1e6
+			 << ",\"maxHoldMs\":" << mutex->maxHoldTime() / 1e6 << "}";
+	}
+	return json.str();
+}
+
+#else
+
+string lockStatsTable(void)
+{
+	return "";
+}
+
+string lockStatsJson(void)
+{
+	return "";
+}
+
+#endif
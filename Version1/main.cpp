@@ -3,7 +3,7 @@
 //  GL travelers
 //
 
-// g++ -Wall -std=c++20 main.cpp gl_frontEnd.cpp -framework OpenGL -framework GLUT -o travel
+// g++ -Wall -std=c++20 main.cpp gl_frontEnd.cpp frameCapture.cpp instrumentedMutex.cpp -framework OpenGL -framework GLUT -o travel
 
  /*-------------------------------------------------------------------------+
  |	A graphic front end for a grid+state simulation.						|
@@ -23,6 +23,15 @@
  |		- 'r' --> add red ink												|
  |		- 'g' --> add green ink												|
  |		- 'b' --> add blue ink												|
+ |		- left/right click in the grid --> zoom in/out						|
+ |		- drag in the grid --> pan, middle click --> whole grid				|
+ |																			|
+ |	With --headless, no window is opened: the simulation runs on its own	|
+ |	until --duration seconds or --steps traveler moves have elapsed.		|
+ |	In either mode, --frames <dir> records the grid every --frame-period	|
+ |	ms as PPM images, raw RGB frames or one RGB stream (--frame-format).	|
+ |	At exit, a table gives the counts and times of every mutex (see		|
+ |	instrumentedMutex.h, -DLOCK_STATS=0 to disable).						|
  +-------------------------------------------------------------------------*/
 
 #include <thread>
@@ -31,13 +40,19 @@
 #include <cstdlib>
 #include <ctime>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <iostream>
 #include <tuple>
-#include <fstream>
 #include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
 //
 #include "glPlatform.h"
 #include "gl_frontEnd.h"
+#include "frameCapture.h"
+#include "instrumentedMutex.h"
 
 using namespace std;
 
@@ -69,6 +84,11 @@ void producerGreenThreadFunc();
 void producerBlueThreadFunc();
 
 void readPipe(std::string pipePath);
+void handleCommand(std::string command);
+void applyPendingRefills(void);
+
+void runHeadless(void);
+void captureThreadFunc();
 
 std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection newDir, int newRow, int newCol);
 
@@ -76,6 +96,8 @@ std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection
 extern int	GRID_PANE, STATE_PANE;
 extern int	gMainWindow, gSubwindow[2];
 bool DRAW_COLORED_TRAVELER_HEADS = true;
+//	upper bound on the redraw rate; frames are only drawn when something changed
+int MAX_FPS = 100;
 
 //	The state grid and its dimensions
 int** grid;
@@ -105,7 +127,11 @@ std::vector<std::thread> producerRedThreads;
 std::vector<std::thread> producerGreenThreads;
 std::vector<std::thread> producerBlueThreads;
 
-std::mutex gridLock, redInkLock, blueInkLock, greenInkLock, refillRedLock, refillBlueLock, refillGreenLock;
+//	they count how often and how long they are waited for and held, for the
+//	table printed by cleanupAndQuit
+InstrumentedMutex gridLock("grid");
+InstrumentedMutex redInkLock("redInk"), greenInkLock("greenInk"), blueInkLock("blueInk");
+InstrumentedMutex refillRedLock("refillRed"), refillGreenLock("refillGreen"), refillBlueLock("refillBlue");
 
 const int CORNER_DISTANCE = 1;
 unsigned int stime = 500000;
@@ -114,6 +140,36 @@ random_device myRandDev;
 default_random_engine myEngine(myRandDev());
 
 std::string pipePath = "/tmp/travpipe";
+//	how long the pipe reader waits for a command before checking
+//	stopSimulation again (in milliseconds), and how much it reads at once
+const int PIPE_POLL_TIMEOUT = 100;
+const int PIPE_BUFFER_SIZE = 4096;
+//	refill commands whose ink doesn't fit in the tank yet.  Only the pipe reader
+//	touches these: it retries them every PIPE_RETRY_TIMEOUT ms while it waits
+//	for more commands, instead of spinning on a full tank and leaving the
+//	commands behind it unread
+int pendingRedRefills = 0, pendingGreenRefills = 0, pendingBlueRefills = 0;
+const int PIPE_RETRY_TIMEOUT = 1;
+
+//	set by cleanupAndQuit to get all simulation threads to return
+std::atomic<bool> stopSimulation(false);
+//	total number of cells traveled, all travelers included
+std::atomic<long> numMoves(0);
+
+//	headless mode: no GLUT window, stop after runDuration seconds or maxSteps
+//	moves (0 means no limit)
+bool headless = false;
+double runDuration = 0;
+long maxSteps = 0;
+//	frame capture: a snapshot of the grid every framePeriod ms goes into a
+//	queue of frameQueueSize buffers drained by the encoder thread
+std::string frameDir;
+int framePeriod = 100;
+CaptureFormat frameFormat = CAPTURE_PPM;
+int frameQueueSize = 8;
+std::thread captureThread;
+//	how often the headless main thread and the capture thread wake up (in microseconds)
+const int HEADLESS_POLL_TIME = 10000;
 //==================================================================================
 //	These are the functions that tie the simulation with the rendering.
 //	Some parts are "don't touch."  Other parts need your intervention
@@ -136,7 +192,7 @@ void displayGridPane(void)
 	//---------------------------------------------------------
 	//	Use this drawing call instead
 	gridLock.lock();
-	drawGridAndTravelers(grid, num_rows, num_cols, travelerList);
+	drawGridAndTravelers(travelerList);
 	gridLock.unlock();
 
 	//	This is OpenGL/glut magic.  Don't touch
@@ -180,6 +236,7 @@ bool acquireRedInk(int theRed)
 	{
 		redLevel -= theRed;
 		ok = true;
+		markSimulationChanged();
 	}
 	redInkLock.unlock();
 	return ok;
@@ -193,6 +250,7 @@ bool acquireGreenInk(int theGreen)
 	{
 		greenLevel -= theGreen;
 		ok = true;
+		markSimulationChanged();
 	}
 	greenInkLock.unlock();
 	return ok;
@@ -206,6 +264,7 @@ bool acquireBlueInk(int theBlue)
 	{
 		blueLevel -= theBlue;
 		ok = true;
+		markSimulationChanged();
 	}
 	blueInkLock.unlock();
 	return ok;
@@ -225,6 +284,7 @@ bool refillRedInk(int theRed)
 	{
 		redLevel += theRed;
 		ok = true;
+		markSimulationChanged();
 	}
 	refillRedLock.unlock();
 	return ok;
@@ -238,6 +298,7 @@ bool refillGreenInk(int theGreen)
 	{
 		greenLevel += theGreen;
 		ok = true;
+		markSimulationChanged();
 	}
 	refillGreenLock.unlock();
 	return ok;
@@ -251,6 +312,7 @@ bool refillBlueInk(int theBlue)
 	{
 		blueLevel += theBlue;
 		ok = true;
+		markSimulationChanged();
 	}
 	refillBlueLock.unlock();
 	return ok;
@@ -284,39 +346,83 @@ void slowdownProducers(void)
 	producerSleepTime = (12 * producerSleepTime) / 10;
 }
 
+// read commands from the named pipe, one per line.  The pipe is opened once for
+// the whole run, read-write so that there always is a writer and read() never
+// reports end-of-file when a client closes its end.  Every complete line that
+// came in gets handled, so a burst of commands written at once is not lost.
 void readPipe(std::string pipe_path) 
 {
-	while (true) 
+	const int pipeFd = open(pipe_path.c_str(), O_RDWR | O_NONBLOCK);
+	if (pipeFd < 0)
+	{
+		std::cerr << "Failed to open named pipe" << std::endl;
+		return;
+	}
+
+	struct pollfd pipePoll = {pipeFd, POLLIN, 0};
+	char buffer[PIPE_BUFFER_SIZE];
+	//	what came in after the last complete line
+	std::string pending;
+	while (!stopSimulation)
 	{
-		std::ifstream pipeStream(pipe_path);
-		if (!pipeStream.is_open()) 
+		const bool refillsPending = pendingRedRefills + pendingGreenRefills + pendingBlueRefills > 0;
+		const int ready = poll(&pipePoll, 1, refillsPending ? PIPE_RETRY_TIMEOUT : PIPE_POLL_TIMEOUT);
+		if (ready <= 0)
 		{
-			std::cerr << "Failed to open named pipe" << std::endl;
-			return;
+			applyPendingRefills();
+			continue;
 		}
 
-		std::string command;
-		std::getline(pipeStream, command);
+		ssize_t count;
+		while ((count = read(pipeFd, buffer, sizeof(buffer))) > 0)
+			pending.append(buffer, count);
 
-		// TODO: Handle command
-		if (command == "r")
-		{
-			while(!refillRedInk(3 * MAX_ADD_INK));
-		}
-		else if (command == "g")
-		{
-			while(!refillGreenInk(3 * MAX_ADD_INK));
-		}
-		else if (command == "b")
+		size_t lineStart = 0, lineEnd;
+		while ((lineEnd = pending.find('\n', lineStart)) != std::string::npos)
 		{
-			while(!refillBlueInk(3 * MAX_ADD_INK));
+			handleCommand(pending.substr(lineStart, lineEnd - lineStart));
+			lineStart = lineEnd + 1;
 		}
-		else if (command == "end") 
-		{
-			exit(0);
-		}
-    }
-    // pipeStream.close();
+		pending.erase(0, lineStart);
+		applyPendingRefills();
+	}
+	close(pipeFd);
+}
+
+// carry out one command read from the pipe.  Refills are queued and go in as
+// soon as their tank has room for them (see applyPendingRefills)
+void handleCommand(std::string command)
+{
+	if (!command.empty() && command.back() == '\r')
+		command.pop_back();
+
+	if (command == "r")
+	{
+		pendingRedRefills++;
+	}
+	else if (command == "g")
+	{
+		pendingGreenRefills++;
+	}
+	else if (command == "b")
+	{
+		pendingBlueRefills++;
+	}
+	else if (command == "end") 
+	{
+		cleanupAndQuit();
+	}
+}
+
+// add the queued refills that fit in their tank now
+void applyPendingRefills(void)
+{
+	while (pendingRedRefills > 0 && refillRedInk(3 * MAX_ADD_INK))
+		pendingRedRefills--;
+	while (pendingGreenRefills > 0 && refillGreenInk(3 * MAX_ADD_INK))
+		pendingGreenRefills--;
+	while (pendingBlueRefills > 0 && refillBlueInk(3 * MAX_ADD_INK))
+		pendingBlueRefills--;
 }
 
 //------------------------------------------------------------------------
@@ -324,12 +430,45 @@ void readPipe(std::string pipe_path)
 //------------------------------------------------------------------------
 int main(int argc, char** argv)
 {
-    // Verify that three arguments were passed
-    if (argc != 4) 
+    // Verify that the positional arguments were passed, then parse the options
+    const std::string usage = std::string("Usage: ") + argv[0] + " <num_cols> <num_rows> <num_threads>"
+		" [--max-fps <n>]"
+		" [--headless [--duration <s>] [--steps <n>]]"
+		" [--frames <dir> [--frame-period <ms>] [--frame-format ppm|raw|stream] [--frame-queue <n>]]\n";
+    if (argc < 4) 
 	{
-        std::cerr << "Usage: " << argv[0] << " <num_cols> <num_rows> <num_threads>\n";
+        std::cerr << usage;
         return 1;
     }
+	for (int k = 4; k < argc; k++)
+	{
+		const std::string option = argv[k];
+		if (option == "--headless")
+			headless = true;
+		else if (option == "--max-fps" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			MAX_FPS = std::atoi(argv[++k]);
+		else if (option == "--duration" && k + 1 < argc)
+			runDuration = std::atof(argv[++k]);
+		else if (option == "--steps" && k + 1 < argc)
+			maxSteps = std::atol(argv[++k]);
+		else if (option == "--frames" && k + 1 < argc)
+			frameDir = argv[++k];
+		else if (option == "--frame-period" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			framePeriod = std::atoi(argv[++k]);
+		else if (option == "--frame-queue" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			frameQueueSize = std::atoi(argv[++k]);
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "ppm")
+			frameFormat = CAPTURE_PPM, k++;
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "raw")
+			frameFormat = CAPTURE_RAW, k++;
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "stream")
+			frameFormat = CAPTURE_STREAM, k++;
+		else
+		{
+			std::cerr << usage;
+			return 1;
+		}
+	}
 
     // Parse arguments and check for validity
     num_cols = std::atoi(argv[1]);
@@ -342,7 +481,8 @@ int main(int argc, char** argv)
         return 1;
     }
 
-	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+	if (!headless)
+		initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
 
 	//	Now we can do application-level
 	initializeApplication();
@@ -350,6 +490,11 @@ int main(int argc, char** argv)
     std::thread readerThread(readPipe, pipePath);
     // readerThread.join();
 
+	//	Without a window, the main thread just watches the simulation
+	//	until it's time to stop
+	if (headless)
+		runHeadless();
+
 	//	Now we enter the main loop of the program and to a large extend
 	//	"lose control" over its execution.  The callback functions that 
 	//	we set up earlier will be called when the corresponding event
@@ -376,13 +521,33 @@ void cleanupAndQuit()
 	//	You would want to join all the threads before you free the grid and other
 	//	allocated data structures.  You may run into seg-fault and other ugly termination
 	//	issues otherwise.
+	//	The main thread (end of a headless run, keyboard) and the pipe reader
+	//	(end command) can both get here: only the first one cleans up, and the
+	//	other one waits for it to exit the process.
+	if (stopSimulation.exchange(true))
+	{
+		while (true)
+			pause();
+	}
+	for (auto& t : travelerThreads)
+		t.join();
+	for (int k = 0; k < (int) producerRedThreads.size(); k++)
+	{
+		producerRedThreads[k].join();
+		producerGreenThreads[k].join();
+		producerBlueThreads[k].join();
+	}
+	if (captureThread.joinable())
+	{
+		captureThread.join();
+		stopFrameCapture();
+		std::cout << "frames captured: " << capturedFrameCount()
+				  << ", dropped: " << droppedFrameCount() << std::endl;
+	}
+	std::cout << lockStatsTable();
 
-	//	just nicer.  Also, if you crash there, you know something is wrong
-	//	in your code.
-	for (int i=0; i< num_rows; i++)
-		delete []grid[i];
-	delete []grid;
-	
+	//	The grid and what goes with it are left for exit() to reclaim: when we
+	//	get here from another thread, the GLUT thread may still be drawing them.
 	exit(0);
 }
 
@@ -414,6 +579,8 @@ void initializeApplication(void)
 		}	
 	}
 
+	initializeGridRendering(grid, num_rows, num_cols);
+
 	//---------------------------------------------------------------
 	//	You're going to have to properly initialize your travelers at random locations
 	//	on the grid:
@@ -434,12 +601,15 @@ void initializeApplication(void)
 		producerGreenThreads.push_back(std::thread(producerGreenThreadFunc));
 		producerBlueThreads.push_back(std::thread(producerBlueThreadFunc));
     }
+
+	if (!frameDir.empty() && startFrameCapture(frameDir, frameFormat, num_rows, num_cols, frameQueueSize))
+		captureThread = std::thread(captureThreadFunc);
 }
 
 // add red ink to its tank
 void producerRedThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillRedInk(MAX_ADD_INK);
@@ -449,7 +619,7 @@ void producerRedThreadFunc()
 // add green ink to its tank
 void producerGreenThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillGreenInk(MAX_ADD_INK);
@@ -459,18 +629,60 @@ void producerGreenThreadFunc()
 // add blue ink to its tank
 void producerBlueThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillBlueInk(MAX_ADD_INK);
 	}
 }
 
+// main thread loop when running without a window
+void runHeadless(void)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	while (true)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		const double elapsed = std::chrono::duration<double>(now - start).count();
+
+		bool anyLive = false;
+		for (const TravelerInfo& traveler : travelerList)
+			anyLive = anyLive || traveler.isLive;
+
+		if (!anyLive || (runDuration > 0 && elapsed >= runDuration) || (maxSteps > 0 && numMoves >= maxSteps))
+		{
+			std::cout << "elapsed: " << elapsed << " s, moves: " << numMoves << std::endl;
+			break;
+		}
+		usleep(HEADLESS_POLL_TIME);
+	}
+	cleanupAndQuit();
+}
+
+// hand a snapshot of the grid to the encoder every framePeriod ms.  The copy
+// is all that happens here; a frame is dropped if the encoder is behind
+void captureThreadFunc()
+{
+	auto nextFrame = std::chrono::steady_clock::now();
+	while (!stopSimulation)
+	{
+		if (std::chrono::steady_clock::now() >= nextFrame)
+		{
+			gridLock.lock();
+			captureFrame(grid);
+			gridLock.unlock();
+			nextFrame += std::chrono::milliseconds(framePeriod);
+		}
+		usleep(HEADLESS_POLL_TIME);
+	}
+}
+
 // function executed by each traveler thread
 void travelerThreadFunc(TravelerInfo *traveler) 
 {
 	
-	while (traveler->isLive)
+	while (traveler->isLive && !stopSimulation)
 	{
 		// random perpendicular direction
 		int currDir  = static_cast<int>(traveler->dir);
@@ -487,7 +699,7 @@ void travelerThreadFunc(TravelerInfo *traveler)
 		int newRow = std::get<0>(myTuple);
 		int newCol = std::get<1>(myTuple);
 		
-		while (traveler->row != newRow) 
+		while (traveler->row != newRow && !stopSimulation) 
 		{
 			traveler->dir = newDir;
 			if (traveler->row < newRow)
@@ -496,10 +708,11 @@ void travelerThreadFunc(TravelerInfo *traveler)
 			else if (traveler->row > newRow)
 				colorTrailDown(traveler);
 
+			numMoves++;
 			usleep(stime);
 		}
 
-		while (traveler->col != newCol)
+		while (traveler->col != newCol && !stopSimulation)
 		{
 			traveler->dir = newDir;
 			if (traveler->col < newCol)
@@ -508,11 +721,15 @@ void travelerThreadFunc(TravelerInfo *traveler)
 			else if (traveler->col > newCol)
 				colorTrailRight(traveler);
 
+			numMoves++;
 			usleep(stime);
 		}
 		
 		if ((traveler->row == 0 && traveler->col == 0) || (traveler->row == 0 && traveler->col == num_cols - 1) || (traveler->row == num_rows - 1 && traveler->col == 0) || (traveler->row == num_rows - 1 && traveler->col == num_cols - 1))
-			traveler->isLive = false; 
+		{
+			traveler->isLive = false;
+			markSimulationChanged();
+		}
 	}
 }
 
@@ -585,7 +802,7 @@ void colorTrailRight(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->col--;
 
@@ -593,11 +810,12 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 			
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | new_color;
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->col--;
 
@@ -605,11 +823,12 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | (new_color << 8);
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->col--;
 
@@ -617,6 +836,7 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | (new_color << 16);
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		gridLock.unlock();
 		break;
@@ -632,7 +852,7 @@ void colorTrailLeft(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->col++;
 
@@ -640,11 +860,12 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | new_color;
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->col++;
 
@@ -652,11 +873,12 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | (new_color << 8);
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->col++;
 
@@ -664,6 +886,7 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | (new_color << 16);
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		gridLock.unlock();
 		break;
@@ -679,7 +902,7 @@ void colorTrailUp(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->row++;
 
@@ -687,11 +910,12 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 		
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | new_color;
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->row++;
 
@@ -699,11 +923,12 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | (new_color << 8);
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->row++;
 
@@ -711,6 +936,7 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | (new_color << 16);
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		gridLock.unlock();
 		break;
@@ -726,7 +952,7 @@ void colorTrailDown(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		while (!acquireRedInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->row--;
 
@@ -734,11 +960,12 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 		
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | new_color;
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		while (!acquireGreenInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->row--;
 
@@ -746,11 +973,12 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | (new_color << 8);
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		while (!acquireBlueInk(1) && !stopSimulation) usleep(1000);
 		gridLock.lock();
 		traveler->row--;
 
@@ -758,6 +986,7 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | (new_color << 16);
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		gridLock.unlock();
 		break;
@@ -0,0 +1,63 @@
+//
+//  commandQueue.cpp
+//
+
+#include "commandQueue.h"
+
+using namespace std;
+
+void initializeCommandQueue(CommandQueue& queue)
+{
+	for (uint32_t k = 0; k < COMMAND_QUEUE_SIZE; k++)
+		queue.slots[k].seq.store(k, memory_order_relaxed);
+	queue.head.store(0, memory_order_relaxed);
+	queue.tail.store(0, memory_order_relaxed);
+	queue.numPushed.store(0, memory_order_relaxed);
+	queue.numRejected.store(0, memory_order_relaxed);
+	queue.maxDepth.store(0, memory_order_relaxed);
+}
+
+//	Slot pos is free for the producer that claims pos when its sequence number
+//	is pos, and holds a command for the consumer when it is pos + 1
+bool pushCommand(CommandQueue& queue, const QueuedCommand& command)
+{
+	uint32_t pos = queue.head.load(memory_order_relaxed);
+	CommandQueue::Slot* slot;
+	while (true)
+	{
+		slot = &queue.slots[pos % COMMAND_QUEUE_SIZE];
+		const int32_t diff = (int32_t) (slot->seq.load(memory_order_acquire) - pos);
+		if (diff == 0 && queue.head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+			break;
+		if (diff < 0)
+		{
+			queue.numRejected.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+		if (diff > 0)
+			pos = queue.head.load(memory_order_relaxed);
+	}
+	slot->command = command;
+	slot->seq.store(pos + 1, memory_order_release);
+
+	queue.numPushed.fetch_add(1, memory_order_relaxed);
+	//	the consumer may already be past it
+	const int32_t depth = (int32_t) (pos + 1 - queue.tail.load(memory_order_relaxed));
+	uint32_t maxDepth = queue.maxDepth.load(memory_order_relaxed);
+	while (depth > (int32_t) maxDepth && !queue.maxDepth.compare_exchange_weak(maxDepth, depth, memory_order_relaxed))
+		;
+	return true;
+}
+
+bool popCommand(CommandQueue& queue, QueuedCommand& command)
+{
+	const uint32_t pos = queue.tail.load(memory_order_relaxed);
+	CommandQueue::Slot& slot = queue.slots[pos % COMMAND_QUEUE_SIZE];
+	if (slot.seq.load(memory_order_acquire) != pos + 1)
+		return false;
+	command = slot.command;
+	//	free for the producer that claims it on the next lap
+	slot.seq.store(pos + COMMAND_QUEUE_SIZE, memory_order_release);
+	queue.tail.store(pos + 1, memory_order_relaxed);
+	return true;
+}
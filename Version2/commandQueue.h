@@ -0,0 +1,47 @@
+//
+//  commandQueue.h
+//
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+
+//-----------------------------------------------------------------------------
+//	Bounded lock-free multi-producer/single-consumer queue of commands.
+//
+//	Any thread can push (the control thread, the keyboard on the GLUT thread),
+//	and a single thread pops.  Each slot has a sequence number telling whose
+//	turn it is: a producer claims a position by moving head forward, fills the
+//	slot, then publishes it through its sequence number, so producers never
+//	wait on each other or on the consumer.  A full queue rejects the push; the
+//	rejections and the deepest the queue got are counted.
+//-----------------------------------------------------------------------------
+
+//	must be a power of two
+const uint32_t COMMAND_QUEUE_SIZE = 1024;
+
+struct QueuedCommand {
+						int32_t op;
+						int32_t args[2];
+};
+
+struct CommandQueue {
+						struct alignas(64) Slot {
+							std::atomic<uint32_t> seq;
+							QueuedCommand command;
+						} slots[COMMAND_QUEUE_SIZE];
+						alignas(64) std::atomic<uint32_t> head;
+						alignas(64) std::atomic<uint32_t> tail;
+						//	backpressure statistics
+						std::atomic<uint64_t> numPushed, numRejected;
+						std::atomic<uint32_t> maxDepth;
+};
+
+void initializeCommandQueue(CommandQueue& queue);
+bool pushCommand(CommandQueue& queue, const QueuedCommand& command);
+//	only ever called by the consumer
+bool popCommand(CommandQueue& queue, QueuedCommand& command);
+
+#endif // COMMAND_QUEUE_H
@@ -0,0 +1,78 @@
+//
+//  commandScript.cpp
+//
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+//
+#include "commandScript.h"
+
+using namespace std;
+
+//	Reports the first malformed line on cerr
+bool loadCommandScript(const string& path, CommandScript& script)
+{
+	ifstream file(path);
+	if (!file)
+	{
+		cerr << "Failed to open script " << path << endl;
+		return false;
+	}
+
+	script.commands.clear();
+	script.next = 0;
+	string line;
+	for (int lineNumber = 1; getline(file, line); lineNumber++)
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		ScriptCommand command;
+		size_t timeLength = 0;
+		const size_t space = line.find(' ');
+		try
+		{
+			if (line.compare(0, 2, "t=") == 0 && space != string::npos)
+				command.time = stod(line.substr(2, space - 2), &timeLength);
+		}
+		catch (const exception&)
+		{
+			timeLength = 0;
+		}
+		if (timeLength == 0 || timeLength != space - 2 || command.time < 0)
+		{
+			cerr << path << ":" << lineNumber << ": expected 't=<seconds> <command>'" << endl;
+			return false;
+		}
+		command.command = line.substr(space + 1);
+		script.commands.push_back(command);
+	}
+	stable_sort(script.commands.begin(), script.commands.end(),
+				[](const ScriptCommand& a, const ScriptCommand& b) { return a.time < b.time; });
+	return true;
+}
+
+void startCommandScript(CommandScript& script)
+{
+	script.next = 0;
+	script.start = chrono::steady_clock::now();
+}
+
+int runCommandScript(CommandScript& script, void (*commandFunc)(string command))
+{
+	while (script.next < script.commands.size())
+	{
+		const ScriptCommand& command = script.commands[script.next];
+		const double wait = command.time - chrono::duration<double>(chrono::steady_clock::now() - script.start).count();
+		//	rounded up, so that we don't wake up just before it is due
+		if (wait > 0)
+			return (int) ceil(wait * 1000);
+		script.next++;
+		commandFunc(command.command);
+	}
+	return -1;
+}
@@ -0,0 +1,42 @@
+//
+//  commandScript.h
+//
+
+#ifndef COMMAND_SCRIPT_H
+#define COMMAND_SCRIPT_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//	Replay of a script of timed commands.
+//
+//	A script has one command per line, preceded by the time it is due at in
+//	seconds since the start of the replay:
+//		t=1.250 r
+//		t=3.000 +
+//		t=5.000 end
+//	Empty lines and lines starting with '#' are skipped.  Commands due at the
+//	same time are carried out in the order of the script.
+//-----------------------------------------------------------------------------
+
+struct ScriptCommand {
+						double time;
+						std::string command;
+};
+
+struct CommandScript {
+						std::vector<ScriptCommand> commands;
+						//	the first command not carried out yet
+						size_t next;
+						std::chrono::steady_clock::time_point start;
+};
+
+bool loadCommandScript(const std::string& path, CommandScript& script);
+void startCommandScript(CommandScript& script);
+//	carries out the commands that are due, and returns how soon (in ms) the
+//	next one is, or -1 if there is none left
+int runCommandScript(CommandScript& script, void (*commandFunc)(std::string command));
+
+#endif // COMMAND_SCRIPT_H
@@ -0,0 +1,171 @@
+//
+//  controlBlock.cpp
+//
+
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+//
+#include "controlBlock.h"
+
+using namespace std;
+
+//---------------------------------------------------------------------------
+//	Mapping the segments
+//---------------------------------------------------------------------------
+
+static void* mapSegment(const char* name, size_t size, bool create)
+{
+	const int fd = shm_open(name, create ? O_CREAT | O_RDWR : O_RDWR, 0600);
+	if (fd < 0)
+		return nullptr;
+	//	a new segment is zero-filled; growing an existing one to its own size
+	//	changes nothing
+	if (create && ftruncate(fd, size) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	void* segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return segment == MAP_FAILED ? nullptr : segment;
+}
+
+//	The process creates (and starts over) its block, controllers map an
+//	existing one
+ControlBlock* mapControlBlock(const char* name, bool create)
+{
+	void* segment = mapSegment(name, sizeof(ControlBlock), create);
+	if (segment == nullptr)
+		return nullptr;
+	if (create)
+	{
+		memset(segment, 0, sizeof(ControlBlock));
+		ControlBlock* block = new (segment) ControlBlock;
+		block->ringSize = CONTROL_RING_SIZE;
+		block->magic = CONTROL_BLOCK_MAGIC;
+		return block;
+	}
+	ControlBlock* block = static_cast<ControlBlock*>(segment);
+	if (block->magic != CONTROL_BLOCK_MAGIC || block->ringSize != CONTROL_RING_SIZE)
+	{
+		munmap(segment, sizeof(ControlBlock));
+		return nullptr;
+	}
+	return block;
+}
+
+//	Whoever comes first creates the broadcast block, zero-filled, which is a
+//	valid empty block
+BroadcastBlock* mapBroadcastBlock(const char* name)
+{
+	return static_cast<BroadcastBlock*>(mapSegment(name, sizeof(BroadcastBlock), true));
+}
+
+void unmapControlBlock(ControlBlock* block, const char* name, bool unlinkName)
+{
+	munmap(block, sizeof(ControlBlock));
+	if (unlinkName)
+		shm_unlink(name);
+}
+
+//---------------------------------------------------------------------------
+//	The command ring
+//---------------------------------------------------------------------------
+
+bool pushControlRequest(ControlBlock* block, const ControlRequest& request)
+{
+	const uint32_t head = block->head.load(memory_order_relaxed);
+	if (head - block->tail.load(memory_order_acquire) == CONTROL_RING_SIZE)
+		return false;
+	block->ring[head % CONTROL_RING_SIZE] = request;
+	block->head.store(head + 1, memory_order_release);
+	return true;
+}
+
+bool popControlRequest(ControlBlock* block, ControlRequest& request)
+{
+	const uint32_t tail = block->tail.load(memory_order_relaxed);
+	if (tail == block->head.load(memory_order_acquire))
+		return false;
+	request = block->ring[tail % CONTROL_RING_SIZE];
+	block->tail.store(tail + 1, memory_order_release);
+	return true;
+}
+
+void publishControlAck(ControlBlock* block, uint32_t seq, uint32_t status)
+{
+	if (status != CONTROL_OK)
+	{
+		const uint32_t count = block->numRefusals.load(memory_order_relaxed);
+		block->refusals[count % CONTROL_REFUSAL_RING_SIZE] = {seq, status};
+		block->numRefusals.store(count + 1, memory_order_release);
+	}
+	block->lastStatus.store(status, memory_order_relaxed);
+	block->lastSeqDone.store(seq, memory_order_release);
+}
+
+//	The process may overwrite the refusal being copied: it is only kept if
+//	the ring hasn't gone past it meanwhile
+bool readControlRefusal(ControlBlock* block, uint32_t& numSeen, ControlRefusal& refusal, uint32_t& numLost)
+{
+	while (true)
+	{
+		const uint32_t count = block->numRefusals.load(memory_order_acquire);
+		if (count == numSeen)
+			return false;
+		if (count - numSeen > CONTROL_REFUSAL_RING_SIZE)
+		{
+			numLost += count - numSeen - CONTROL_REFUSAL_RING_SIZE;
+			numSeen = count - CONTROL_REFUSAL_RING_SIZE;
+		}
+		memcpy(&refusal, &block->refusals[numSeen % CONTROL_REFUSAL_RING_SIZE], sizeof(refusal));
+		atomic_thread_fence(memory_order_acquire);
+		const bool overwritten = block->numRefusals.load(memory_order_relaxed) - numSeen > CONTROL_REFUSAL_RING_SIZE;
+		numSeen++;
+		if (!overwritten)
+			return true;
+		numLost++;
+	}
+}
+
+//---------------------------------------------------------------------------
+//	The broadcast ring
+//---------------------------------------------------------------------------
+
+void broadcastControlRequest(BroadcastBlock* block, const ControlRequest& request)
+{
+	const uint32_t count = block->count.load(memory_order_relaxed);
+	BroadcastSlot& slot = block->slots[count % BROADCAST_RING_SIZE];
+	slot.seq.store(2 * count + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&slot.request, &request, sizeof(request));
+	slot.seq.store(2 * count + 2, memory_order_release);
+	block->count.store(count + 1, memory_order_release);
+}
+
+bool readBroadcastRequest(BroadcastBlock* block, uint32_t& numSeen, ControlRequest& request, uint32_t& numLost)
+{
+	while (true)
+	{
+		const uint32_t count = block->count.load(memory_order_acquire);
+		if (count == numSeen)
+			return false;
+		if (count - numSeen > BROADCAST_RING_SIZE)
+		{
+			numLost += count - numSeen - BROADCAST_RING_SIZE;
+			numSeen = count - BROADCAST_RING_SIZE;
+		}
+		const BroadcastSlot& slot = block->slots[numSeen % BROADCAST_RING_SIZE];
+		const uint32_t seq = slot.seq.load(memory_order_acquire);
+		memcpy(&request, &slot.request, sizeof(request));
+		atomic_thread_fence(memory_order_acquire);
+		const bool intact = seq == 2 * numSeen + 2 && slot.seq.load(memory_order_relaxed) == seq;
+		numSeen++;
+		if (intact)
+			return true;
+		numLost++;
+	}
+}
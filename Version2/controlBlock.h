@@ -0,0 +1,109 @@
+//
+//  controlBlock.h
+//
+
+#ifndef CONTROL_BLOCK_H
+#define CONTROL_BLOCK_H
+
+#include <atomic>
+#include <cstdint>
+//
+#include "controlProtocol.h"
+
+//-----------------------------------------------------------------------------
+//	Shared-memory control of a travel process.
+//
+//	Each process started with --control-shm <name> creates a POSIX shared memory
+//	segment holding a ControlBlock.  A controller maps it and, without any
+//	system call:
+//		- pushes ControlRequests (see controlProtocol.h) into the command ring,
+//		  a single-producer/single-consumer ring with the controller as the
+//		  only producer.  The process records the sequence number and status of
+//		  the last request it carried out, and keeps the last refusals (any
+//		  status but CONTROL_OK) in a ring, so that none goes unnoticed when
+//		  several requests are carried out between two looks.
+//		- reads the ink levels and traveler counts the process publishes.
+//	With --control-broadcast <name>, every process also watches one shared
+//	BroadcastBlock: a request written there once is carried out by all of them.
+//	It keeps the last BROADCAST_RING_SIZE broadcasts, so a process that falls
+//	further behind than that loses the oldest ones, and knows how many.
+//-----------------------------------------------------------------------------
+
+const uint32_t CONTROL_BLOCK_MAGIC = 0x54524156;
+//	must be a power of two
+const uint32_t CONTROL_RING_SIZE = 1024;
+const uint32_t CONTROL_REFUSAL_RING_SIZE = 64;
+
+struct ControlRefusal {
+						uint32_t seq;
+						uint32_t status;
+};
+
+struct ControlBlock {
+						uint32_t magic;
+						uint32_t ringSize;
+
+						//	the controller writes ring[head % ringSize], then moves
+						//	head; the process reads up to head, then moves tail
+						alignas(64) std::atomic<uint32_t> head;
+						alignas(64) std::atomic<uint32_t> tail;
+						alignas(64) ControlRequest ring[CONTROL_RING_SIZE];
+
+						//	published by the process
+						alignas(64) std::atomic<uint32_t> lastSeqDone;
+						std::atomic<uint32_t> lastStatus;
+						//	refusals[n % CONTROL_REFUSAL_RING_SIZE] is the nth
+						//	one, written before numRefusals moves past it
+						std::atomic<uint32_t> numRefusals;
+						ControlRefusal refusals[CONTROL_REFUSAL_RING_SIZE];
+						std::atomic<int32_t> redLevel, greenLevel, blueLevel;
+						std::atomic<int32_t> numTravelers, numLiveTravelers;
+						std::atomic<int64_t> numMoves;
+						//	incremented each time the process looks at the block
+						std::atomic<uint64_t> heartbeat;
+};
+
+//	must be a power of two
+const uint32_t BROADCAST_RING_SIZE = 64;
+
+//	A seqlock per slot: the writer of the nth broadcast makes the slot's seq
+//	2n + 1, writes the request, then makes seq 2n + 2.  Readers take a request
+//	whose seq is the one they expect, unchanged across their copy.
+struct BroadcastSlot {
+						std::atomic<uint32_t> seq;
+						ControlRequest request;
+};
+
+//	The nth broadcast goes in slots[n % BROADCAST_RING_SIZE], then count
+//	moves past it.  One writer at a time.
+struct BroadcastBlock {
+						std::atomic<uint32_t> count;
+						BroadcastSlot slots[BROADCAST_RING_SIZE];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<int64_t>::is_always_lock_free,
+			  "the control block needs address-free atomics");
+
+ControlBlock* mapControlBlock(const char* name, bool create);
+BroadcastBlock* mapBroadcastBlock(const char* name);
+void unmapControlBlock(ControlBlock* block, const char* name, bool unlinkName);
+
+//	Controller side: false if the ring is full
+bool pushControlRequest(ControlBlock* block, const ControlRequest& request);
+void broadcastControlRequest(BroadcastBlock* block, const ControlRequest& request);
+
+//	Controller side: copies the next refusal after the first numSeen ones and
+//	moves numSeen past it, false if there is none.  Refusals overwritten
+//	before being read are added to numLost.
+bool readControlRefusal(ControlBlock* block, uint32_t& numSeen, ControlRefusal& refusal, uint32_t& numLost);
+
+//	Process side: copies the next request out of the ring, false if it's empty
+bool popControlRequest(ControlBlock* block, ControlRequest& request);
+//	Records that the request with this seq was carried out, with this status
+void publishControlAck(ControlBlock* block, uint32_t seq, uint32_t status);
+//	Copies the next broadcast after the first numSeen ones and moves numSeen
+//	past it, false if there is none.  Broadcasts overwritten before being read
+//	are added to numLost.
+bool readBroadcastRequest(BroadcastBlock* block, uint32_t& numSeen, ControlRequest& request, uint32_t& numLost);
+
+#endif // CONTROL_BLOCK_H
@@ -0,0 +1,89 @@
+//
+//  controlProtocol.h
+//
+
+#ifndef CONTROL_PROTOCOL_H
+#define CONTROL_PROTOCOL_H
+
+#include <cstdint>
+
+//-----------------------------------------------------------------------------
+//	Binary control protocol, spoken on the --control-binary-socket.
+//
+//	A client writes requests back to back, as many per write as it likes, and
+//	gets one acknowledgement per request, in order, carrying the request's
+//	sequence number once the operation has been carried out (or refused).
+//	Every message starts with a ControlHeader whose length is the size of the
+//	whole message, header included.  Fields are in host byte order: both ends
+//	are on the same machine.
+//-----------------------------------------------------------------------------
+
+enum ControlOp {
+						//	args[0]: ink color (a TravelerType), args[1]: amount
+						CONTROL_REFILL = 1,
+						//	args[0]: traveler sleep time between moves (in us)
+						CONTROL_SET_TRAVELER_SPEED,
+						//	args[0]: ink producer sleep time (in us)
+						CONTROL_SET_PRODUCER_PERIOD,
+						//	args[0]: traveler type, -1 for a random one.
+						//	The ack's value is the new traveler's index
+						CONTROL_SPAWN_TRAVELER,
+						//	args[0]: traveler index.  Acked once the traveler
+						//	has stopped, which it does before its next step
+						//	or while waiting for ink
+						CONTROL_KILL_TRAVELER,
+						//	acked with a ControlStatsAck
+						CONTROL_QUERY_STATS,
+						//	acked, then the application quits
+						CONTROL_END
+};
+
+enum ControlStatus {
+						CONTROL_OK = 0,
+						//	the ink doesn't fit in the tank right now
+						CONTROL_TANK_FULL,
+						CONTROL_BAD_ARGUMENT,
+						CONTROL_UNKNOWN_OP,
+						//	the simulation is stopping, or is out of room for
+						//	another traveler or queued command
+						CONTROL_REFUSED
+};
+
+struct ControlHeader {
+						uint16_t length;
+						//	a ControlOp; acks echo the request's
+						uint8_t op;
+						//	0 in requests, a ControlStatus in acks
+						uint8_t status;
+						uint32_t seq;
+};
+
+struct ControlRequest {
+						ControlHeader header;
+						int32_t args[2];
+};
+
+struct ControlAck {
+						ControlHeader header;
+						int32_t value;
+};
+
+struct ControlStats {
+						int64_t numMoves;
+						int32_t numTravelers;
+						int32_t numLiveTravelers;
+						int32_t redLevel, greenLevel, blueLevel;
+						int32_t travelerSleepTime;
+						int32_t producerSleepTime;
+						int32_t reserved;
+};
+
+struct ControlStatsAck {
+						ControlHeader header;
+						ControlStats stats;
+};
+
+//	the largest message a reader has to buffer; longer ones are a protocol error
+const uint16_t MAX_CONTROL_MESSAGE_LENGTH = 256;
+
+#endif // CONTROL_PROTOCOL_H
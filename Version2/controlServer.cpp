@@ -0,0 +1,474 @@
+//
+//  controlServer.cpp
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__linux__)
+	#include <sys/epoll.h>
+#endif
+//	macOS has no MSG_NOSIGNAL, clients' sockets get SO_NOSIGPIPE instead
+#if !defined(MSG_NOSIGNAL)
+	#define MSG_NOSIGNAL 0
+#endif
+//
+#include "controlServer.h"
+#include "controlProtocol.h"
+
+using namespace std;
+
+//---------------------------------------------------------------------------
+//  File-level global variables
+//---------------------------------------------------------------------------
+
+enum ControlSourceKind {
+						//	opened read-write, so it never reaches end-of-file
+						FIFO_SOURCE = 0,
+						//	listening sockets: readable means a client is waiting
+						LISTEN_SOURCE,
+						BINARY_LISTEN_SOURCE,
+						//	socket client or stdin, dropped at end-of-file
+						STREAM_SOURCE,
+						//	client of the binary socket
+						BINARY_SOURCE
+};
+
+struct ControlSource {
+						ControlSourceKind kind;
+						//	what came in after the last complete line or message
+						string pending;
+						//	acks the client hasn't taken yet
+						string outgoing;
+						//	what the source is being watched for
+						bool watchIn, watchOut;
+						//	an ack waiting for heldReady() to return true.  The
+						//	client's next messages wait for it, unread
+						function<bool(void)> heldReady;
+						string heldAck;
+};
+
+//	how much is read from one source per wakeup, how many sources are reported
+//	by one wait, and how many unsent acks a client can pile up before it stops
+//	being read from
+const int CONTROL_BUFFER_SIZE = 4096;
+const int MAX_CONTROL_EVENTS = 64;
+const size_t MAX_CONTROL_OUTGOING = 1 << 20;
+//	how often held acks are looked at (in ms)
+const int HELD_ACK_POLL_TIMEOUT = 1;
+
+map<int, ControlSource> controlSources;
+ControlCommandFunc controlCommandFunc = nullptr;
+ControlMessageFunc controlMessageFunc = nullptr;
+ControlIdleFunc controlIdleFunc = nullptr;
+//	stopControlServer writes into this pipe to get the loop out of its wait
+int controlWakeupPipe[2] = {-1, -1};
+atomic<bool> controlStopping(false);
+vector<string> controlSocketPaths;
+//	where the replies to commands read from FIFOs go, if anywhere
+string controlReplyFifo;
+#if defined(__linux__)
+int controlEpollFd = -1;
+#endif
+//	set by holdControlAck during a call to the message function
+function<bool(void)> heldAckReady;
+
+//	a source reported by a wait, and whether it can be read and/or written
+struct ControlEvent {
+						int fd;
+						bool in, out;
+};
+
+//---------------------------------------------------------------------------
+//	Waiting on the sources: epoll on Linux, poll() elsewhere
+//---------------------------------------------------------------------------
+
+static bool watchSource(int fd, bool in, bool out, bool isNew)
+{
+#if defined(__linux__)
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = (in ? static_cast<uint32_t>(EPOLLIN) : 0u) | (out ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+	event.data.fd = fd;
+	return epoll_ctl(controlEpollFd, isNew ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) == 0;
+#else
+	(void) fd, (void) in, (void) out, (void) isNew;
+	return true;
+#endif
+}
+
+static void removeSource(int fd)
+{
+#if defined(__linux__)
+	epoll_ctl(controlEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+	if (fd != STDIN_FILENO)
+		close(fd);
+	controlSources.erase(fd);
+}
+
+//	Waits at most timeout ms (-1 for no limit) and fills events with the
+//	sources that are ready
+static void waitForSources(int timeout, vector<ControlEvent>& events)
+{
+	events.clear();
+#if defined(__linux__)
+	struct epoll_event epollEvents[MAX_CONTROL_EVENTS];
+	const int count = epoll_wait(controlEpollFd, epollEvents, MAX_CONTROL_EVENTS, timeout);
+	for (int k=0; k<count; k++)
+	{
+		//	errors and hang-ups show up as a read returning 0 or -1
+		const uint32_t flags = epollEvents[k].events;
+		events.push_back({epollEvents[k].data.fd, (flags & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0, (flags & EPOLLOUT) != 0});
+	}
+#else
+	vector<struct pollfd> polls;
+	polls.push_back({controlWakeupPipe[0], POLLIN, 0});
+	for (const auto& source : controlSources)
+		polls.push_back({source.first, static_cast<short>((source.second.watchIn ? POLLIN : 0) |
+														  (source.second.watchOut ? POLLOUT : 0)), 0});
+	if (poll(polls.data(), polls.size(), timeout) > 0)
+		for (const struct pollfd& p : polls)
+			if (p.revents != 0)
+				events.push_back({p.fd, (p.revents & (POLLIN | POLLERR | POLLHUP)) != 0, (p.revents & POLLOUT) != 0});
+#endif
+}
+
+//---------------------------------------------------------------------------
+//	Sources
+//---------------------------------------------------------------------------
+
+static bool addSource(int fd, ControlSourceKind kind)
+{
+	if (!watchSource(fd, true, false, true))
+		return false;
+	controlSources[fd] = {kind, string(), string(), true, false, nullptr, string()};
+	return true;
+}
+
+bool initializeControlServer(ControlCommandFunc commandFunc, ControlMessageFunc messageFunc, ControlIdleFunc idleFunc)
+{
+	controlCommandFunc = commandFunc;
+	controlMessageFunc = messageFunc;
+	controlIdleFunc = idleFunc;
+	//	a reply FIFO can lose its reader between our open and our write
+	signal(SIGPIPE, SIG_IGN);
+	if (pipe(controlWakeupPipe) != 0)
+		return false;
+#if defined(__linux__)
+	controlEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (controlEpollFd < 0)
+		return false;
+#endif
+	return watchSource(controlWakeupPipe[0], true, false, true);
+}
+
+bool addControlFifo(const std::string& path)
+{
+	const int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	if (!addSource(fd, FIFO_SOURCE))
+	{
+		close(fd);
+		return false;
+	}
+	return true;
+}
+
+static bool addListeningSocket(const std::string& path, ControlSourceKind kind)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	if (path.size() >= sizeof(address.sun_path))
+		return false;
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path.c_str());
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	unlink(path.c_str());
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+		listen(fd, SOMAXCONN) != 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+		!addSource(fd, kind))
+	{
+		close(fd);
+		return false;
+	}
+	controlSocketPaths.push_back(path);
+	return true;
+}
+
+bool addControlSocket(const std::string& path)
+{
+	return addListeningSocket(path, LISTEN_SOURCE);
+}
+
+bool addControlBinarySocket(const std::string& path)
+{
+	return addListeningSocket(path, BINARY_LISTEN_SOURCE);
+}
+
+//	stdin stays blocking (it may be shared with a terminal), which is fine
+//	since it is only read after being reported readable
+bool addControlStdin(void)
+{
+	return addSource(STDIN_FILENO, STREAM_SOURCE);
+}
+
+//	The FIFO is opened for each reply, and the reply dropped if nobody has it
+//	open for reading
+void setControlReplyFifo(const std::string& path)
+{
+	controlReplyFifo = path;
+}
+
+//---------------------------------------------------------------------------
+//	The loop
+//---------------------------------------------------------------------------
+
+static void acceptClients(int listenFd, ControlSourceKind clientKind)
+{
+	int clientFd;
+	while ((clientFd = accept(listenFd, nullptr, nullptr)) >= 0)
+	{
+		fcntl(clientFd, F_SETFL, O_NONBLOCK);
+#if defined(SO_NOSIGPIPE)
+		const int noSigPipe = 1;
+		setsockopt(clientFd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+		if (!addSource(clientFd, clientKind))
+			close(clientFd);
+	}
+}
+
+//	Sends what it can of a client's acks.  A client that doesn't keep up gets
+//	watched for writing, and no longer for reading once too much piled up.
+//	Returns false if the client is gone.
+static bool flushSource(int fd)
+{
+	ControlSource& source = controlSources[fd];
+	while (!source.outgoing.empty())
+	{
+		const ssize_t count = send(fd, source.outgoing.data(), source.outgoing.size(), MSG_NOSIGNAL);
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (count <= 0 && errno != EINTR)
+		{
+			removeSource(fd);
+			return false;
+		}
+		if (count > 0)
+			source.outgoing.erase(0, count);
+	}
+
+	const bool in = source.outgoing.size() < MAX_CONTROL_OUTGOING && !source.heldReady, out = !source.outgoing.empty();
+	if (in != source.watchIn || out != source.watchOut)
+	{
+		watchSource(fd, in, out, false);
+		source.watchIn = in;
+		source.watchOut = out;
+	}
+	return true;
+}
+
+//	Hands every complete binary message in a client's buffer to the message
+//	function, up to one whose ack is held.  Returns false on a malformed
+//	message.
+static bool handleMessages(ControlSource& source)
+{
+	size_t start = 0;
+	while (source.pending.size() - start >= sizeof(ControlHeader) && !source.heldReady && !controlStopping)
+	{
+		ControlHeader header;
+		memcpy(&header, source.pending.data() + start, sizeof(header));
+		if (header.length < sizeof(ControlHeader) || header.length > MAX_CONTROL_MESSAGE_LENGTH)
+			return false;
+		if (source.pending.size() - start < header.length)
+			break;
+		string acks;
+		heldAckReady = nullptr;
+		controlMessageFunc(source.pending.data() + start, header.length, acks);
+		if (heldAckReady)
+		{
+			source.heldReady = heldAckReady;
+			source.heldAck = acks;
+		}
+		else
+			source.outgoing += acks;
+		start += header.length;
+	}
+	source.pending.erase(0, start);
+	return true;
+}
+
+//	Hands every complete line in a source's buffer to the command function,
+//	collecting what it replies
+static void handleLines(ControlSource& source, string& replies)
+{
+	size_t lineStart = 0, lineEnd;
+	while ((lineEnd = source.pending.find('\n', lineStart)) != string::npos && !controlStopping)
+	{
+		controlCommandFunc(source.pending.substr(lineStart, lineEnd - lineStart), replies);
+		lineStart = lineEnd + 1;
+	}
+	source.pending.erase(0, lineStart);
+}
+
+//	Sends the replies to a text source's commands back where they came from.
+//	Returns false if the source is a client that is gone.
+static bool sendReplies(int fd, ControlSource& source, const string& replies)
+{
+	if (replies.empty())
+		return true;
+	if (source.kind == FIFO_SOURCE)
+	{
+		const int replyFd = controlReplyFifo.empty() ? -1 : open(controlReplyFifo.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if (replyFd >= 0)
+		{
+			if (write(replyFd, replies.data(), replies.size()) < 0)
+				cerr << "Failed to write to the reply FIFO" << endl;
+			close(replyFd);
+		}
+		return true;
+	}
+	if (fd == STDIN_FILENO)
+	{
+		if (write(STDOUT_FILENO, replies.data(), replies.size()) < 0)
+			cerr << "Failed to write the replies to stdout" << endl;
+		return true;
+	}
+	source.outgoing += replies;
+	return flushSource(fd);
+}
+
+//	One read from a source, then everything complete in its buffer is handled
+static void readSource(int fd)
+{
+	char buffer[CONTROL_BUFFER_SIZE];
+	const ssize_t count = read(fd, buffer, sizeof(buffer));
+	if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+
+	ControlSource& source = controlSources[fd];
+	if (count > 0)
+		source.pending.append(buffer, count);
+
+	if (source.kind == BINARY_SOURCE)
+	{
+		if (!handleMessages(source))
+		{
+			cerr << "Malformed control message, dropping the client" << endl;
+			removeSource(fd);
+			return;
+		}
+		if (!flushSource(fd))
+			return;
+	}
+	else
+	{
+		string replies;
+		handleLines(source, replies);
+		//	a closed text client still gets its last, unterminated line handled,
+		//	and its replies if it only closed its end for writing
+		if (count <= 0 && !source.pending.empty() && !controlStopping)
+			controlCommandFunc(source.pending, replies);
+		if (!sendReplies(fd, source, replies))
+			return;
+	}
+
+	if (count <= 0)
+		removeSource(fd);
+}
+
+//	Sends the held acks that can go, and handles the messages that waited
+//	behind them.  Returns whether some acks are still held.
+static bool releaseHeldAcks(void)
+{
+	vector<int> released;
+	for (auto& entry : controlSources)
+		if (entry.second.heldReady && entry.second.heldReady())
+			released.push_back(entry.first);
+
+	//	a client can be removed on the way, so not while going through the map
+	for (int fd : released)
+	{
+		ControlSource& source = controlSources[fd];
+		source.outgoing += source.heldAck;
+		source.heldAck.clear();
+		source.heldReady = nullptr;
+		if (!handleMessages(source))
+		{
+			cerr << "Malformed control message, dropping the client" << endl;
+			removeSource(fd);
+			continue;
+		}
+		flushSource(fd);
+	}
+
+	for (const auto& entry : controlSources)
+		if (entry.second.heldReady)
+			return true;
+	return false;
+}
+
+void holdControlAck(std::function<bool(void)> ready)
+{
+	heldAckReady = ready;
+}
+
+void runControlServer(void)
+{
+	vector<ControlEvent> events;
+	int timeout = controlIdleFunc != nullptr ? controlIdleFunc() : -1;
+	while (!controlStopping)
+	{
+		waitForSources(timeout, events);
+		for (const ControlEvent& event : events)
+		{
+			if (controlStopping)
+				break;
+			if (event.fd == controlWakeupPipe[0] || controlSources.count(event.fd) == 0)
+				continue;
+
+			const ControlSourceKind kind = controlSources[event.fd].kind;
+			if (kind == LISTEN_SOURCE)
+				acceptClients(event.fd, STREAM_SOURCE);
+			else if (kind == BINARY_LISTEN_SOURCE)
+				acceptClients(event.fd, BINARY_SOURCE);
+			else
+			{
+				if (event.out && !flushSource(event.fd))
+					continue;
+				if (event.in)
+					readSource(event.fd);
+			}
+		}
+		timeout = controlIdleFunc != nullptr ? controlIdleFunc() : -1;
+		if (releaseHeldAcks() && (timeout < 0 || timeout > HELD_ACK_POLL_TIMEOUT))
+			timeout = HELD_ACK_POLL_TIMEOUT;
+	}
+}
+
+//	Can be called from any thread, the control thread included.  The loop
+//	returns after the command being handled, if any.
+void stopControlServer(void)
+{
+	if (controlStopping.exchange(true))
+		return;
+	if (controlWakeupPipe[1] >= 0 && write(controlWakeupPipe[1], "x", 1) < 0)
+		cerr << "Failed to wake up the control server" << endl;
+	for (const string& path : controlSocketPaths)
+		unlink(path.c_str());
+}
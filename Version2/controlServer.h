@@ -0,0 +1,52 @@
+//
+//  controlServer.h
+//
+
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <string>
+#include <cstddef>
+#include <functional>
+
+//-----------------------------------------------------------------------------
+//	Event-driven control plane.
+//
+//	One thread multiplexes every command source (FIFOs, a Unix domain socket and
+//	its clients, stdin) and hands each complete line to the command function.
+//	What the command function replies goes back to a socket client on its
+//	connection, to stdout for stdin, and to the reply FIFO for the FIFOs.
+//	Clients of the binary socket speak the protocol of controlProtocol.h: each
+//	complete message goes to the message function, and the acks it produces
+//	for one read are sent back in one write.  An ack that must wait for the
+//	operation to take effect is held, and the client's next messages with
+//	it, while the other sources go on being served.
+//	Each source has its own buffers and gets at most one read per wakeup, so a
+//	flood or a half-written message from one controller never holds up the
+//	others.
+//-----------------------------------------------------------------------------
+
+//	Called on the control thread with each command line (without the newline);
+//	appends its reply, if any, to replies
+typedef void (*ControlCommandFunc)(std::string command, std::string& replies);
+//	Called on the control thread with each complete binary message (length
+//	bytes, header included); appends its ack(s) to replies
+typedef void (*ControlMessageFunc)(const char* message, size_t length, std::string& replies);
+//	Called on the control thread after every wakeup; returns how many ms it
+//	wants to wait at most before being called again, -1 for no limit
+typedef int (*ControlIdleFunc)(void);
+
+bool initializeControlServer(ControlCommandFunc commandFunc, ControlMessageFunc messageFunc, ControlIdleFunc idleFunc);
+bool addControlFifo(const std::string& path);
+bool addControlSocket(const std::string& path);
+bool addControlBinarySocket(const std::string& path);
+bool addControlStdin(void);
+void setControlReplyFifo(const std::string& path);
+void runControlServer(void);
+void stopControlServer(void);
+//	Called by the message function: the ack it appends for this message only
+//	goes once ready() returns true, and the client's next messages are only
+//	handled then.  ready is asked on the control thread after every wakeup.
+void holdControlAck(std::function<bool(void)> ready);
+
+#endif // CONTROL_SERVER_H
@@ -0,0 +1,66 @@
+//
+//  domain.cpp
+//
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+//
+#include "domain.h"
+
+using namespace std;
+
+//	Every process of the domain maps the same block, whoever comes first
+//	creates it
+DomainBlock* mapDomainBlock(const char* name)
+{
+	const int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0)
+		return nullptr;
+	if (ftruncate(fd, sizeof(DomainBlock)) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	void* segment = mmap(nullptr, sizeof(DomainBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return segment == MAP_FAILED ? nullptr : static_cast<DomainBlock*>(segment);
+}
+
+void unmapDomainBlock(DomainBlock* block, const char* name, bool unlinkName)
+{
+	munmap(block, sizeof(DomainBlock));
+	if (unlinkName)
+		shm_unlink(name);
+}
+
+//	Strip `partition` of numRows rows split in numPartitions, the first ones
+//	getting a row more when it doesn't divide evenly
+void partitionRows(int numRows, int numPartitions, int partition, int& firstRow, int& partitionRows)
+{
+	const int baseRows = numRows / numPartitions, extraRows = numRows % numPartitions;
+	firstRow = partition * baseRows + min(partition, extraRows);
+	partitionRows = baseRows + (partition < extraRows ? 1 : 0);
+}
+
+//	A single producer at a time (the sender serializes its threads)
+bool pushHandoff(HandoffRing& ring, const TravelerHandoff& handoff)
+{
+	const uint32_t head = ring.head.load(memory_order_relaxed);
+	if (head - ring.tail.load(memory_order_acquire) == HANDOFF_RING_SIZE)
+		return false;
+	ring.slots[head % HANDOFF_RING_SIZE] = handoff;
+	ring.head.store(head + 1, memory_order_release);
+	return true;
+}
+
+bool popHandoff(HandoffRing& ring, TravelerHandoff& handoff)
+{
+	const uint32_t tail = ring.tail.load(memory_order_relaxed);
+	if (tail == ring.head.load(memory_order_acquire))
+		return false;
+	handoff = ring.slots[tail % HANDOFF_RING_SIZE];
+	ring.tail.store(tail + 1, memory_order_release);
+	return true;
+}
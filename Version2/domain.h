@@ -0,0 +1,55 @@
+//
+//  domain.h
+//
+
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <atomic>
+#include <cstdint>
+
+//-----------------------------------------------------------------------------
+//	One logical grid split across processes.
+//
+//	With --domain <name> --partition <k>/<n>, a process only holds strip k of
+//	the n horizontal strips of the grid, and the travelers in it.  A traveler
+//	that walks off its strip is handed to the neighboring process through the
+//	shared DomainBlock: each pair of neighbors has one ring per direction,
+//	written by the sending process (whose traveler threads take turns) and
+//	read by the receiving process's control thread.
+//	Partition 0 removes the block's name when it quits.
+//-----------------------------------------------------------------------------
+
+const int MAX_DOMAIN_PARTITIONS = 64;
+//	must be a power of two
+const uint32_t HANDOFF_RING_SIZE = 256;
+
+//	Where a traveler enters the next strip and where it was heading, in rows
+//	of the whole grid
+struct TravelerHandoff {
+						int32_t type;
+						int32_t dir;
+						int32_t row, col;
+						int32_t targetRow, targetCol;
+};
+
+struct HandoffRing {
+						alignas(64) std::atomic<uint32_t> head;
+						alignas(64) std::atomic<uint32_t> tail;
+						alignas(64) TravelerHandoff slots[HANDOFF_RING_SIZE];
+};
+
+//	toNext[k] goes from partition k to k+1, toPrevious[k] from k to k-1.
+//	A zero-filled block is a valid, empty one.
+struct DomainBlock {
+						HandoffRing toNext[MAX_DOMAIN_PARTITIONS];
+						HandoffRing toPrevious[MAX_DOMAIN_PARTITIONS];
+};
+
+DomainBlock* mapDomainBlock(const char* name);
+void unmapDomainBlock(DomainBlock* block, const char* name, bool unlinkName);
+void partitionRows(int numRows, int numPartitions, int partition, int& firstRow, int& partitionRows);
+bool pushHandoff(HandoffRing& ring, const TravelerHandoff& handoff);
+bool popHandoff(HandoffRing& ring, TravelerHandoff& handoff);
+
+#endif // DOMAIN_H
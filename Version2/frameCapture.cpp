@@ -0,0 +1,189 @@
+//
+//  frameCapture.cpp
+//
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+//
+#include "frameCapture.h"
+
+using namespace std;
+
+//---------------------------------------------------------------------------
+//  File-level global variables
+//---------------------------------------------------------------------------
+
+struct CapturedFrame {
+						unsigned long index;
+						vector<uint32_t> cells;
+};
+
+string captureDir;
+CaptureFormat captureFormat = CAPTURE_PPM;
+int captureRows = 0, captureCols = 0;
+
+//	every buffer is either in the free pool, in the queue, or being
+//	filled/encoded by exactly one thread
+vector<CapturedFrame*> freeFrames;
+deque<CapturedFrame*> queuedFrames;
+mutex captureLock;
+condition_variable frameQueued;
+bool captureStopping = false;
+thread encoderThread;
+ofstream streamFile;
+
+atomic<unsigned long> numCaptured(0), numDropped(0);
+unsigned long nextFrameIndex = 0;
+
+//---------------------------------------------------------------------------
+//	Encoder side
+//---------------------------------------------------------------------------
+
+void encodeFrame(const CapturedFrame& frame, vector<unsigned char>& rgb)
+{
+	//	a grid value is 0xAABBGGRR
+	size_t k = 0;
+	for (uint32_t value : frame.cells)
+	{
+		rgb[k++] = value & 0xFF;
+		rgb[k++] = (value >> 8) & 0xFF;
+		rgb[k++] = (value >> 16) & 0xFF;
+	}
+
+	if (captureFormat == CAPTURE_STREAM)
+	{
+		streamFile.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+		return;
+	}
+
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "/frame_%05lu.%s", frame.index,
+			 captureFormat == CAPTURE_PPM ? "ppm" : "rgb");
+	ofstream frameStream(captureDir + fileName, ios::binary);
+	if (!frameStream.is_open())
+	{
+		cerr << "Failed to write frame in " << captureDir << endl;
+		return;
+	}
+	if (captureFormat == CAPTURE_PPM)
+		frameStream << "P6\n" << captureCols << " " << captureRows << "\n255\n";
+	frameStream.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+}
+
+void encoderThreadFunc()
+{
+	vector<unsigned char> rgb(3 * static_cast<size_t>(captureRows) * captureCols);
+
+	while (true)
+	{
+		unique_lock<mutex> lock(captureLock);
+		frameQueued.wait(lock, [] { return captureStopping || !queuedFrames.empty(); });
+		if (queuedFrames.empty())
+			break;
+		CapturedFrame* frame = queuedFrames.front();
+		queuedFrames.pop_front();
+		lock.unlock();
+
+		encodeFrame(*frame, rgb);
+
+		lock.lock();
+		freeFrames.push_back(frame);
+	}
+}
+
+//---------------------------------------------------------------------------
+//	Capture functions
+//---------------------------------------------------------------------------
+
+bool startFrameCapture(const std::string& dir, CaptureFormat format, int numRows, int numCols, int queueSize)
+{
+	captureDir = dir;
+	captureFormat = format;
+	captureRows = numRows;
+	captureCols = numCols;
+
+	if (format == CAPTURE_STREAM)
+	{
+		streamFile.open(dir + "/capture.rgb", ios::binary);
+		if (!streamFile.is_open())
+		{
+			cerr << "Failed to open " << dir << "/capture.rgb" << endl;
+			return false;
+		}
+	}
+
+	for (int k=0; k<queueSize; k++)
+	{
+		CapturedFrame* frame = new CapturedFrame;
+		frame->cells.resize(static_cast<size_t>(numRows) * numCols);
+		freeFrames.push_back(frame);
+	}
+	captureStopping = false;
+	encoderThread = thread(encoderThreadFunc);
+	return true;
+}
+
+//	Called by whichever thread takes the snapshot, with the grid protected from
+//	writers for the duration of the call.  Returns false if the frame was dropped.
+bool captureFrame(int** grid)
+{
+	unique_lock<mutex> lock(captureLock);
+	if (captureStopping || freeFrames.empty())
+	{
+		numDropped++;
+		return false;
+	}
+	CapturedFrame* frame = freeFrames.back();
+	freeFrames.pop_back();
+	frame->index = nextFrameIndex++;
+	lock.unlock();
+
+	for (int i=0; i<captureRows; i++)
+		memcpy(&frame->cells[static_cast<size_t>(i) * captureCols], grid[i], captureCols * sizeof(uint32_t));
+
+	lock.lock();
+	queuedFrames.push_back(frame);
+	numCaptured++;
+	lock.unlock();
+	frameQueued.notify_one();
+	return true;
+}
+
+//	Writes out whatever is still queued, then stops the encoder
+void stopFrameCapture(void)
+{
+	{
+		lock_guard<mutex> lock(captureLock);
+		if (captureStopping || !encoderThread.joinable())
+			return;
+		captureStopping = true;
+	}
+	frameQueued.notify_one();
+	encoderThread.join();
+
+	for (CapturedFrame* frame : freeFrames)
+		delete frame;
+	freeFrames.clear();
+	if (streamFile.is_open())
+		streamFile.close();
+}
+
+unsigned long capturedFrameCount(void)
+{
+	return numCaptured;
+}
+
+unsigned long droppedFrameCount(void)
+{
+	return numDropped;
+}
@@ -0,0 +1,34 @@
+//
+//  frameCapture.h
+//
+
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <string>
+
+//-----------------------------------------------------------------------------
+//	Asynchronous capture of grid snapshots to disk.
+//
+//	captureFrame() copies the grid into one of a fixed pool of buffers and
+//	queues it; an encoder thread converts the queued frames to RGB and writes
+//	them out.  When the encoder falls behind and no buffer is free, the frame
+//	is dropped rather than making the caller wait.
+//-----------------------------------------------------------------------------
+
+enum CaptureFormat {
+						//	one binary PPM image per frame (frame_00000.ppm, ...)
+						CAPTURE_PPM = 0,
+						//	one headerless RGB24 file per frame (frame_00000.rgb, ...)
+						CAPTURE_RAW,
+						//	all frames appended to a single RGB24 stream (capture.rgb)
+						CAPTURE_STREAM
+};
+
+bool startFrameCapture(const std::string& dir, CaptureFormat format, int numRows, int numCols, int queueSize);
+bool captureFrame(int** grid);
+void stopFrameCapture(void);
+unsigned long capturedFrameCount(void);
+unsigned long droppedFrameCount(void);
+
+#endif // FRAME_CAPTURE_H
@@ -29,6 +29,8 @@
     #endif
 //  Linux and Unix
 #elif  (defined(__FreeBSD__) || defined(__linux__) || defined(sgi) || defined(__NetBSD__) || defined(__OpenBSD) || defined(__QNX__))
+    //  declares the post-1.1 entry points (pixel buffer objects, ...) too
+    #define GL_GLEXT_PROTOTYPES
     #include <GL/gl.h>
     #include <GL/glut.h>
 
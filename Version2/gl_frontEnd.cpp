@@ -6,6 +6,11 @@
 #include <vector>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <array>
 #include <sstream>
 //
 #include "glPlatform.h"
@@ -16,24 +21,24 @@ using namespace std;
 //---------------------------------------------------------------------------
 //	ink access functions.
 //---------------------------------------------------------------------------
-bool acquireRedInk(int theRed);
-bool acquireGreenInk(int theGreen);
-bool acquireBlueInk(int theBlue);
-bool refillRedInk(int theRed);
-bool refillGreenInk(int theGreen);
-bool refillBlueInk(int theBlue);
+bool requestRefill(TravelerType type, int amount);
 
 //---------------------------------------------------------------------------
 //  Private functions' prototypes
 //---------------------------------------------------------------------------
 
 void myResize(int w, int h);
+void drawTravelers(vector<TravelerInfo>& travelerList, float DH, float DV);
+uint32_t maxChannels(uint32_t a, uint32_t b);
 void drawnTankFrame(int LEVEL_WIDTH, int LEVEL_HEIGHT);
 void fillTank(int y, int LEVEL_WIDTH);
 void displayTextualInfo(const char* infoStr, int x, int y, int isLarge);
 void myMouse(int b, int s, int x, int y);
 void myGridPaneMouse(int b, int s, int x, int y);
+void myGridPaneMotion(int x, int y);
 void myStatePaneMouse(int b, int s, int x, int y);
+void zoomView(float factor, int x, int y);
+void setViewOrigin(int row0, int col0);
 void myKeyboard(unsigned char c, int x, int y);
 void myMenuHandler(int value);
 void mySubmenuHandler(int colorIndex);
@@ -62,9 +67,6 @@ enum FirstSubmenuItemID {	FIRST_SUBMENU_ITEM = 11,
 
 #define SMALL_DISPLAY_FONT    GLUT_BITMAP_HELVETICA_12
 #define LARGE_DISPLAY_FONT    GLUT_BITMAP_HELVETICA_18
-const int SMALL_FONT_HEIGHT = 12;
-const int LARGE_FONT_HEIGHT = 18;
-const int TEXT_PADDING = 0;
 const float kTextColor[4] = {1.f, 1.f, 1.f, 1.f};
 
 
@@ -78,8 +80,17 @@ const int STATE_PANE_HEIGHT = GRID_PANE_HEIGHT;
 const int H_PADDING = 0;
 const int WINDOW_WIDTH = GRID_PANE_WIDTH + STATE_PANE_WIDTH + H_PADDING;
 const int WINDOW_HEIGHT = GRID_PANE_HEIGHT;
+//	grid lines are only drawn over cells at least that wide (in pixels),
+//	and traveler heads are never drawn smaller than a cell that size
+const float MIN_LINED_CELL_SIZE = 4.f;
+const float MIN_HEAD_SIZE = 12.f;
+//	the view never gets smaller than that many cells across, and the mouse has
+//	to move that many pixels before a click turns into a drag
+const int MIN_VIEW_CELLS = 8;
+const int DRAG_THRESHOLD = 3;
 
 extern bool DRAW_COLORED_TRAVELER_HEADS;
+extern int MAX_FPS;
 
 //---------------------------------------------------------------------------
 //  File-level global variables
@@ -87,6 +98,8 @@ extern bool DRAW_COLORED_TRAVELER_HEADS;
 
 void (*gridDisplayFunc)(void);
 void (*stateDisplayFunc)(void);
+//	called by the timer before each frame, drawn or not
+void (*timerFunc)(void) = nullptr;
 
 //	We use a window split into two panes/subwindows.  The subwindows
 //	will be accessed by an index.
@@ -105,136 +118,506 @@ extern int MAX_NUM_TRAVELER_THREADS;
 //---------------------------------------------------------------------------
 
 
-//	This is the function that does the actual grid drawing
-void drawGrid(int**grid, int numRows, int numCols)
+//	Bumped by anything that changes what is on screen (trail writes, ink levels,
+//	travelers terminating).  The timer only redraws when it moved since the
+//	last frame, so an idle simulation costs no rendering and no gridLock.
+std::atomic<unsigned long> simulationGeneration(0);
+unsigned long lastDrawnGeneration = ~0UL;
+
+void markSimulationChanged(void)
 {
-	const int	DH = GRID_PANE_WIDTH / numCols,
-				DV = GRID_PANE_HEIGHT / numRows;
-	
-	glTranslatef(0.f, GRID_PANE_HEIGHT, 0.f);
-	glScalef(1.f, -1.f, 1.f);
+	simulationGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+//	The grid is rendered as a single textured quad: each cell is one texel of
+//	an RGBA8 texture that gets refreshed from the grid before drawing.  Nearest
+//	filtering keeps the cells crisp whatever their size on screen.
+//
+//	Grids larger than the pane are drawn from a pyramid of downsampled levels:
+//	a texel of level k is the channel-wise max of a 2^k x 2^k block of cells,
+//	and we draw the first level that fits in the pane.  Trail colors only ever
+//	grow, so a trail write can be pushed up the pyramid incrementally with an
+//	atomic max, stopping at the first level it doesn't change.
+//
+//	Each level is split into GRID_TILE_SIZE x GRID_TILE_SIZE tiles with one
+//	dirty bit each.  Writes set the bit of the tiles they changed and the
+//	renderer only uploads the tiles whose bit it cleared.
+const int GRID_TILE_SIZE = 32;
+
+struct GridLevel {
+						int rows, cols;
+						//	nullptr for level 0, which is the grid itself
+						std::atomic<uint32_t>* cells;
+						int tileRows, tileCols;
+						std::atomic<uint64_t>* dirtyTiles;
+};
+vector<GridLevel> gridLevels;
+int** gridCells = nullptr;
+
+GLuint gridTexture = 0;
+//	window of a level currently held by the texture (level -1 before the first upload)
+int gridTextureLevel = -1, gridTextureRow0 = 0, gridTextureCol0 = 0, gridTextureRows = 0, gridTextureCols = 0;
+//	contiguous copy of the window's rows, the source of the texture uploads
+//	when there are no pixel buffer objects
+vector<GLuint> gridTexels;
+
+//	Pixel buffer objects are core since OpenGL 2.1, but the Windows headers
+//	stop at 1.1.  The texels of each upload are staged in the next buffer of a
+//	ring, so that filling one can overlap with the driver still transferring
+//	the previous ones to the texture.
+#if defined(GL_PIXEL_UNPACK_BUFFER) && !defined(_WIN32)
+	#define USE_PIXEL_BUFFERS 1
+#else
+	#define USE_PIXEL_BUFFERS 0
+#endif
+const int PIXEL_BUFFER_RING_SIZE = 3;
+GLuint pixelBuffers[PIXEL_BUFFER_RING_SIZE] = {0};
+int pixelBufferIndex = 0;
+bool usePixelBuffers = false;
+//	the parts of the window staged for this upload: {row, col, rows, cols}
+//	relative to the window
+vector<array<int, 4> > stagedRects;
+
+//	The view: the block of cells shown in the grid pane.  Clicking in the grid
+//	pane zooms in (left button) or out (right button) around the mouse, dragging
+//	pans, and the middle button goes back to the whole grid.  Only the part of
+//	the grid and the travelers in the view get looked at when rendering.
+int viewRow0 = 0, viewCol0 = 0, viewRows = 0, viewCols = 0;
+int dragX, dragY, dragRow0, dragCol0;
+bool dragMoved = false;
+
+//	Optional application callback listing the travelers in a block of cells,
+//	so that we don't have to go through the whole traveler list
+void (*travelerQueryFunc)(int rowMin, int colMin, int rowMax, int colMax, std::vector<int>& ids) = nullptr;
+
+void initializeGridRendering(int** grid, int numRows, int numCols)
+{
+	gridCells = grid;
+	viewRows = numRows;
+	viewCols = numCols;
+	int rows = numRows, cols = numCols;
+	while (true)
+	{
+		GridLevel level;
+		level.rows = rows;
+		level.cols = cols;
+		level.cells = gridLevels.empty() ? nullptr : new std::atomic<uint32_t>[static_cast<size_t>(rows) * cols];
+		level.tileRows = (rows + GRID_TILE_SIZE - 1) / GRID_TILE_SIZE;
+		level.tileCols = (cols + GRID_TILE_SIZE - 1) / GRID_TILE_SIZE;
+		level.dirtyTiles = new std::atomic<uint64_t>[(level.tileRows * level.tileCols + 63) / 64];
+		gridLevels.push_back(level);
+
+		if (rows <= GRID_PANE_HEIGHT && cols <= GRID_PANE_WIDTH)
+			break;
+		rows = (rows + 1) / 2;
+		cols = (cols + 1) / 2;
+	}
 
-	//	Display the grid as a series of quad strips
-	for (int i=0; i<numRows; i++)
+	//	seed each downsampled level from the one below it
+	for (int k=1; k<(int) gridLevels.size(); k++)
 	{
-		glBegin(GL_QUAD_STRIP);
-			for (int j=0; j<numCols; j++)
+		const GridLevel &below = gridLevels[k-1], &level = gridLevels[k];
+		for (int i=0; i<below.rows; i++)
+			for (int j=0; j<below.cols; j++)
 			{
-				
-				glColor4f((grid[i][j] & 0x000000FF)/255.f, ((grid[i][j] & 0x0000FF00) >> 8)/255.f,
-						  ((grid[i][j] & 0x00FF0000) >> 16)/255.f, 1.f);
-
-				glVertex2i(j*DH, i*DV);
-				glVertex2i(j*DH, (i+1)*DV);
-				glVertex2i((j+1)*DH, i*DV);
-				glVertex2i((j+1)*DH, (i+1)*DV);
+				const uint32_t value = (k == 1) ? static_cast<uint32_t>(grid[i][j]) :
+									   below.cells[static_cast<size_t>(i) * below.cols + j].load(std::memory_order_relaxed);
+				std::atomic<uint32_t>& cell = level.cells[static_cast<size_t>(i/2) * level.cols + j/2];
+				cell.store(maxChannels(cell.load(std::memory_order_relaxed), value), std::memory_order_relaxed);
 			}
-		glEnd();
 	}
-	
-	//	Then draw a grid of lines on top of the squares
+}
+
+//	Channel-wise max of two 0xAABBGGRR colors
+uint32_t maxChannels(uint32_t a, uint32_t b)
+{
+	uint32_t result = 0;
+	for (int shift=0; shift<32; shift+=8)
+		result |= max((a >> shift) & 0xFF, (b >> shift) & 0xFF) << shift;
+	return result;
+}
+
+static void markTileDirty(GridLevel& level, int row, int col)
+{
+	const int tile = (row / GRID_TILE_SIZE) * level.tileCols + col / GRID_TILE_SIZE;
+	const uint64_t bit = uint64_t(1) << (tile % 64);
+
+	//	always a read-modify-write, even if the bit looks set already: a plain load
+	//	could see the bit before the renderer clears it and our write gets lost
+	level.dirtyTiles[tile / 64].fetch_or(bit, std::memory_order_release);
+}
+
+//	Called after a grid cell was written to
+void markGridCellDirty(int row, int col)
+{
+	const uint32_t value = gridCells[row][col];
+	markTileDirty(gridLevels[0], row, col);
+
+	for (int k=1; k<(int) gridLevels.size(); k++)
+	{
+		GridLevel& level = gridLevels[k];
+		row >>= 1;
+		col >>= 1;
+		std::atomic<uint32_t>& cell = level.cells[static_cast<size_t>(row) * level.cols + col];
+		uint32_t current = cell.load(std::memory_order_relaxed);
+		uint32_t merged = maxChannels(current, value);
+		if (merged == current)
+			break;
+		while (!cell.compare_exchange_weak(current, merged, std::memory_order_relaxed))
+			merged = maxChannels(current, value);
+		markTileDirty(level, row, col);
+	}
+	markSimulationChanged();
+}
+
+//	Copies count texels of row `row` of a level, starting at column col0
+static void copyLevelRow(int levelIndex, int row, int col0, int count, GLuint* dest)
+{
+	if (levelIndex == 0)
+		memcpy(dest, gridCells[row] + col0, count * sizeof(GLuint));
+	else
+	{
+		const std::atomic<uint32_t>* cells = gridLevels[levelIndex].cells + static_cast<size_t>(row) * gridLevels[levelIndex].cols + col0;
+		for (int j=0; j<count; j++)
+			dest[j] = cells[j].load(std::memory_order_relaxed);
+	}
+}
+
+//	Checks once a GL context exists whether pixel buffer objects can be used
+static bool pixelBuffersAvailable(void)
+{
+#if USE_PIXEL_BUFFERS
+	const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+	const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+	int major = 0, minor = 0;
+	if (version != nullptr && sscanf(version, "%d.%d", &major, &minor) == 2 &&
+		(major > 2 || (major == 2 && minor >= 1)))
+		return true;
+	return extensions != nullptr && strstr(extensions, "GL_ARB_pixel_buffer_object") != nullptr;
+#else
+	return false;
+#endif
+}
+
+//	Returns where to write the texels of a window of count texels for this
+//	upload: the next pixel buffer of the ring, orphaned and mapped for writing,
+//	or the client-side staging buffer
+static GLuint* beginTexelStaging(size_t count)
+{
+	stagedRects.clear();
+#if USE_PIXEL_BUFFERS
+	if (usePixelBuffers)
+	{
+		pixelBufferIndex = (pixelBufferIndex + 1) % PIXEL_BUFFER_RING_SIZE;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffers[pixelBufferIndex]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, count * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+		GLuint* texels = static_cast<GLuint*>(glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY));
+		if (texels != nullptr)
+			return texels;
+		//	can't map, stop trying
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		usePixelBuffers = false;
+	}
+#endif
+	if (gridTexels.size() < count)
+		gridTexels.resize(count);
+	return gridTexels.data();
+}
+
+//	Sends the staged rectangles of a window `cols` texels wide to the texture.
+//	With a pixel buffer, glTexSubImage2D takes offsets into the buffer and
+//	returns without waiting for the transfer.
+static void endTexelStaging(GLuint* texels, int cols)
+{
+	const char* source = reinterpret_cast<const char*>(texels);
+#if USE_PIXEL_BUFFERS
+	if (usePixelBuffers)
+	{
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		source = nullptr;
+	}
+#endif
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, cols);
+	for (const array<int, 4>& rect : stagedRects)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect[1], rect[0], rect[3], rect[2],
+						GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
+						source + (static_cast<size_t>(rect[0]) * cols + rect[1]) * sizeof(GLuint));
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#if USE_PIXEL_BUFFERS
+	if (usePixelBuffers)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+}
+
+//	Copies a window of a level of the grid into the texture: rows [row0, row0+rows)
+//	and columns [col0, col0+cols) of level levelIndex.  When the texture held
+//	another window the whole window is uploaded, afterwards only the parts of it
+//	covered by dirty tiles.  Tiles outside the window are never looked at.
+//	A grid value is 0xAABBGGRR, which is exactly what GL_RGBA +
+//	GL_UNSIGNED_INT_8_8_8_8_REV expects, whatever the endianness.
+void uploadGridTexture(int levelIndex, int row0, int col0, int rows, int cols)
+{
+	GridLevel& level = gridLevels[levelIndex];
+	const int	tileRowMin = row0 / GRID_TILE_SIZE, tileRowMax = (row0 + rows - 1) / GRID_TILE_SIZE,
+				tileColMin = col0 / GRID_TILE_SIZE, tileColMax = (col0 + cols - 1) / GRID_TILE_SIZE;
+
+	if (gridTexture == 0)
+	{
+		glGenTextures(1, &gridTexture);
+		usePixelBuffers = pixelBuffersAvailable();
+#if USE_PIXEL_BUFFERS
+		if (usePixelBuffers)
+			glGenBuffers(PIXEL_BUFFER_RING_SIZE, pixelBuffers);
+#endif
+	}
+	glBindTexture(GL_TEXTURE_2D, gridTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	const bool newWindow = levelIndex != gridTextureLevel || row0 != gridTextureRow0 || col0 != gridTextureCol0;
+	if (rows != gridTextureRows || cols != gridTextureCols)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cols, rows, 0,
+					 GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, nullptr);
+		gridTextureRows = rows;
+		gridTextureCols = cols;
+	}
+	else if (!newWindow)
+	{
+		//	same window as last frame: only refresh what the dirty tiles cover
+		GLuint* texels = nullptr;
+		for (int ti=tileRowMin; ti<=tileRowMax; ti++)
+		{
+			for (int tj=tileColMin; tj<=tileColMax; tj++)
+			{
+				const int tile = ti * level.tileCols + tj;
+				const uint64_t bit = uint64_t(1) << (tile % 64);
+				if ((level.dirtyTiles[tile / 64].fetch_and(~bit, std::memory_order_acquire) & bit) == 0)
+					continue;
+
+				//	nothing gets staged (or mapped) on a frame without dirty tiles
+				if (texels == nullptr)
+					texels = beginTexelStaging(static_cast<size_t>(rows) * cols);
+
+				//	the part of the tile that lies in the window
+				const int	r0 = max(ti * GRID_TILE_SIZE, row0), r1 = min((ti + 1) * GRID_TILE_SIZE, row0 + rows),
+							c0 = max(tj * GRID_TILE_SIZE, col0), c1 = min((tj + 1) * GRID_TILE_SIZE, col0 + cols);
+				GLuint* tileTexels = texels + static_cast<size_t>(r0 - row0) * cols + (c0 - col0);
+				for (int i=r0; i<r1; i++)
+					copyLevelRow(levelIndex, i, c0, c1 - c0, tileTexels + static_cast<size_t>(i - r0) * cols);
+				stagedRects.push_back({r0 - row0, c0 - col0, r1 - r0, c1 - c0});
+			}
+		}
+		if (texels != nullptr)
+			endTexelStaging(texels, cols);
+		return;
+	}
+
+	//	the whole window goes up this time, so clear its tiles' dirty bits first
+	for (int ti=tileRowMin; ti<=tileRowMax; ti++)
+		for (int tj=tileColMin; tj<=tileColMax; tj++)
+		{
+			const int tile = ti * level.tileCols + tj;
+			level.dirtyTiles[tile / 64].fetch_and(~(uint64_t(1) << (tile % 64)), std::memory_order_acquire);
+		}
+
+	GLuint* texels = beginTexelStaging(static_cast<size_t>(rows) * cols);
+	for (int i=0; i<rows; i++)
+		copyLevelRow(levelIndex, row0 + i, col0, cols, texels + static_cast<size_t>(i) * cols);
+	stagedRects.push_back({0, 0, rows, cols});
+	endTexelStaging(texels, cols);
+	gridTextureLevel = levelIndex;
+	gridTextureRow0 = row0;
+	gridTextureCol0 = col0;
+}
+
+//	Draws the part of the grid that is in the view: picks the finest level whose
+//	texels are no smaller than the pane's pixels, uploads the window of that level
+//	covering the view, and draws it as one quad.  Sets the size of a cell on screen.
+void drawGridView(float& DH, float& DV)
+{
+	DH = static_cast<float>(GRID_PANE_WIDTH) / viewCols;
+	DV = static_cast<float>(GRID_PANE_HEIGHT) / viewRows;
+
+	int k = 0;
+	while (k < (int) gridLevels.size() - 1 &&
+		   (((viewCols + (1 << k) - 1) >> k) > GRID_PANE_WIDTH || ((viewRows + (1 << k) - 1) >> k) > GRID_PANE_HEIGHT))
+		k++;
+
+	//	texels of level k covering the view
+	const int	row0 = viewRow0 >> k, row1 = min((viewRow0 + viewRows - 1) >> k, gridLevels[k].rows - 1),
+				col0 = viewCol0 >> k, col1 = min((viewCol0 + viewCols - 1) >> k, gridLevels[k].cols - 1);
+	uploadGridTexture(k, row0, col0, row1 - row0 + 1, col1 - col0 + 1);
+
+	//	the window's texels may stick out of the view by part of a block, the
+	//	viewport clips that
+	const float	x0 = ((col0 << k) - viewCol0) * DH, x1 = (((col1 + 1) << k) - viewCol0) * DH,
+				y0 = ((row0 << k) - viewRow0) * DV, y1 = (((row1 + 1) << k) - viewRow0) * DV;
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, gridTexture);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glBegin(GL_QUADS);
+		glTexCoord2f(0.f, 0.f);
+		glVertex2f(x0, y0);
+		glTexCoord2f(1.f, 0.f);
+		glVertex2f(x1, y0);
+		glTexCoord2f(1.f, 1.f);
+		glVertex2f(x1, y1);
+		glTexCoord2f(0.f, 1.f);
+		glVertex2f(x0, y1);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
+}
+
+//	Draws a grid of lines on top of the squares in the view, unless the squares
+//	are too small for the lines to leave anything visible
+void drawGridLines(float DH, float DV)
+{
+	if (DH < MIN_LINED_CELL_SIZE || DV < MIN_LINED_CELL_SIZE)
+		return;
+
 	glColor4f(0.5f, 0.5f, 0.5f, 1.f);
 	glBegin(GL_LINES);
 		//	Horizontal
-		for (int i=0; i<= numRows; i++)
+		for (int i=0; i<= viewRows; i++)
 		{
-			glVertex2i(0, i*DV);
-			glVertex2i(GRID_PANE_WIDTH, i*DV);
+			glVertex2f(0.f, i*DV);
+			glVertex2f(GRID_PANE_WIDTH, i*DV);
 		}
 		//	Vertical
-		for (int j=0; j<= numCols; j++)
+		for (int j=0; j<= viewCols; j++)
 		{
-			glVertex2i(j*DH, 0);
-			glVertex2i(j*DH, GRID_PANE_HEIGHT);
+			glVertex2f(j*DH, 0.f);
+			glVertex2f(j*DH, GRID_PANE_HEIGHT);
 		}
 	glEnd();
 }
 
-void drawGridAndTravelers(int**grid, int numRows, int numCols, vector<TravelerInfo>& travelerList)
+//	This is the function that does the actual grid drawing
+void drawGrid(void)
 {
-	const int	DH = GRID_PANE_WIDTH / numCols,
-				DV = GRID_PANE_HEIGHT / numRows;
+	float DH, DV;
 	
 	glTranslatef(0.f, GRID_PANE_HEIGHT, 0.f);
 	glScalef(1.f, -1.f, 1.f);
 
-	//	Display the grid as a series of quad strips
-	for (int i=0; i<numRows; i++)
+	drawGridView(DH, DV);
+	drawGridLines(DH, DV);
+}
+
+void drawGridAndTravelers(vector<TravelerInfo>& travelerList)
+{
+	float DH, DV;
+	
+	glTranslatef(0.f, GRID_PANE_HEIGHT, 0.f);
+	glScalef(1.f, -1.f, 1.f);
+
+	drawGridView(DH, DV);
+	drawGridLines(DH, DV);
+	
+	drawTravelers(travelerList, DH, DV);
+}
+
+//	Travelers are drawn from one vertex array holding a triangle per live
+//	traveler (position, heading and type color baked in), filled with a single
+//	glDrawArrays and outlined with a single glDrawElements, instead of a
+//	matrix push and two glBegin blocks per traveler.
+struct TravelerVertex {
+						GLfloat x, y;
+						GLubyte r, g, b, a;
+};
+vector<TravelerVertex> travelerVertices;
+//	pairs of vertex indices for the outlines, three edges per traveler
+vector<GLuint> travelerOutlines;
+//	travelers in the view, when the application can tell us which they are
+vector<int> visibleTravelers;
+
+void drawTravelers(vector<TravelerInfo>& travelerList, float DH, float DV)
+{
+	//	The head triangle in the traveler's frame, then rotated for each direction
+	//	by the same (180 - 90 dir) degrees the per-traveler glRotatef used to apply.
+	//	On large grids the heads are kept big enough to be seen.
+	const float headWidth = max(DH, MIN_HEAD_SIZE), headHeight = max(DV, MIN_HEAD_SIZE);
+	const GLfloat headX[3] = {headWidth/6.f, 0.f, -headWidth/6.f},
+				  headY[3] = {-headHeight/4.f, headHeight/4.f, -headHeight/4.f};
+	GLfloat dirX[NUM_TRAVEL_DIRECTIONS][3], dirY[NUM_TRAVEL_DIRECTIONS][3];
+	for (int d=0; d<NUM_TRAVEL_DIRECTIONS; d++)
 	{
-		glBegin(GL_QUAD_STRIP);
-			for (int j=0; j<numCols; j++)
-			{
-				//	Set the color of the grid square by using the RGBA color channels
-				//	extracted from the grid int value.
-				glColor4f((grid[i][j] & 0x000000FF)/255.f, ((grid[i][j] & 0x0000FF00) >> 8)/255.f,
-						  ((grid[i][j] & 0x00FF0000) >> 16)/255.f, 1.f);
-
-				glVertex2i(j*DH, i*DV);
-				glVertex2i(j*DH, (i+1)*DV);
-				glVertex2i((j+1)*DH, i*DV);
-				glVertex2i((j+1)*DH, (i+1)*DV);
-			}
-		glEnd();
+		const float angle = (180.f - d * 90.f) * static_cast<float>(M_PI) / 180.f;
+		const float c = roundf(cosf(angle)), s = roundf(sinf(angle));
+		for (int k=0; k<3; k++)
+		{
+			dirX[d][k] = c*headX[k] - s*headY[k];
+			dirY[d][k] = s*headX[k] + c*headY[k];
+		}
 	}
-	
-	//	Then draw a grid of lines on top of the squares
-	glColor4f(0.5f, 0.5f, 0.5f, 1.f);
-	glBegin(GL_LINES);
-		//	Horizontal
-		for (int i=0; i<= numRows; i++)
+	const GLubyte typeColor[NUM_TRAV_TYPES][3] = {{255, 0, 0}, {0, 255, 0}, {0, 0, 255}};
+
+	//	Snapshot the live travelers in the view straight into the vertex array
+	travelerVertices.clear();
+	auto addTraveler = [&](const TravelerInfo& traveler)
+	{
+		if (!traveler.isLive || traveler.row < viewRow0 || traveler.row >= viewRow0 + viewRows ||
+			traveler.col < viewCol0 || traveler.col >= viewCol0 + viewCols)
+			return;
+
+		const GLfloat x = (traveler.col - viewCol0 + 0.5f)*DH, y = (traveler.row - viewRow0 + 0.5f)*DV;
+		const int d = static_cast<int>(traveler.dir);
+		TravelerVertex vert;
+		if (DRAW_COLORED_TRAVELER_HEADS)
 		{
-			glVertex2i(0, i*DV);
-			glVertex2i(GRID_PANE_WIDTH, i*DV);
+			vert.r = typeColor[traveler.type][0];
+			vert.g = typeColor[traveler.type][1];
+			vert.b = typeColor[traveler.type][2];
 		}
-		//	Vertical
-		for (int j=0; j<= numCols; j++)
+		else
 		{
-			glVertex2i(j*DH, 0);
-			glVertex2i(j*DH, GRID_PANE_HEIGHT);
+			vert.r = vert.g = vert.b = 0;
 		}
-	glEnd();
-	
-	//	Draw the travelers
-	for (auto traveler : travelerList)
-	{
-		if (traveler.isLive)
+		vert.a = 255;
+		for (int k=0; k<3; k++)
 		{
-			glPushMatrix();
-			glTranslatef((traveler.col + 0.5f)*DH, (traveler.row + 0.5f)*DV, 0.f);
-			glRotatef(180.f - static_cast<float>(traveler.dir) * 90.f, 0.f, 0.f, 1.f);
-			if (DRAW_COLORED_TRAVELER_HEADS)
-			{
-				switch ((int)(traveler.type))
-				{
-					case RED_TRAV:
-						glColor4f(1.f, 0.f, 0.f, 1.f);
-						break;
-					case GREEN_TRAV:
-						glColor4f(0.f, 1.f, 0.f, 1.f);
-						break;
-					case BLUE_TRAV:
-						glColor4f(0.f, 0.f, 1.f, 1.f);
-						break;
-				}
-			}
-			else
-			{
-				glColor4f(0.f, 0.f, 0.f, 1.f);
-			}
-			glBegin(GL_POLYGON);
-				glVertex2f(DH/6.f, -DV/4.f);
-				glVertex2f(0.f, DV/4.f);
-				glVertex2f(-DH/6.f, -DV/4.f);
-			glEnd();
-			glColor4f(1.f, 1.f, 1.f, 1.f);
-			glBegin(GL_LINE_LOOP);
-				glVertex2f(DH/6.f, -DV/4.f);
-				glVertex2f(0.f, DV/4.f);
-				glVertex2f(-DH/6.f, -DV/4.f);
-			glEnd();
-			glPopMatrix();
+			vert.x = x + dirX[d][k];
+			vert.y = y + dirY[d][k];
+			travelerVertices.push_back(vert);
 		}
+	};
+	if (travelerQueryFunc != nullptr)
+	{
+		visibleTravelers.clear();
+		travelerQueryFunc(viewRow0, viewCol0, viewRow0 + viewRows - 1, viewCol0 + viewCols - 1, visibleTravelers);
+		for (int id : visibleTravelers)
+			addTraveler(travelerList[id]);
+	}
+	else
+	{
+		for (const TravelerInfo& traveler : travelerList)
+			addTraveler(traveler);
 	}
+	const GLsizei numVertices = static_cast<GLsizei>(travelerVertices.size());
+	if (numVertices == 0)
+		return;
+
+	//	The outline indices only depend on the number of travelers
+	for (GLuint k=static_cast<GLuint>(travelerOutlines.size()) / 2; k<static_cast<GLuint>(numVertices); k+=3)
+	{
+		const GLuint edges[6] = {k, k+1, k+1, k+2, k+2, k};
+		travelerOutlines.insert(travelerOutlines.end(), edges, edges+6);
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(TravelerVertex), &travelerVertices[0].x);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(TravelerVertex), &travelerVertices[0].r);
+	glDrawArrays(GL_TRIANGLES, 0, numVertices);
+	glDisableClientState(GL_COLOR_ARRAY);
+
+	glColor4f(1.f, 1.f, 1.f, 1.f);
+	glDrawElements(GL_LINES, 2*numVertices, GL_UNSIGNED_INT, travelerOutlines.data());
+	glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 
@@ -260,78 +643,58 @@ void fillTank(int y, int LEVEL_WIDTH)
 }
 
 
-void displayTextualInfo(const char* infoStr, int xPos, int yPos, int isLarge)
+//	Text is drawn from display lists built once per font, one list per character
+//	holding just its glutBitmapCharacter call.  Each bitmap moves the raster
+//	position by the character's width, so a whole string is one glRasterPos and
+//	one glCallLists.  Lists belong to the GL context they were built in, here the
+//	state pane's.
+GLuint smallFontLists = 0, largeFontLists = 0;
+const int NUM_FONT_LISTS = 128;
+
+GLuint fontLists(int isLarge)
 {
-    //-----------------------------------------------
-    //  0.  get current material properties
-    //-----------------------------------------------
-    float oldAmb[4], oldDif[4], oldSpec[4], oldShiny;
-    glGetMaterialfv(GL_FRONT, GL_AMBIENT, oldAmb);
-    glGetMaterialfv(GL_FRONT, GL_DIFFUSE, oldDif);
-    glGetMaterialfv(GL_FRONT, GL_SPECULAR, oldSpec);
-    glGetMaterialfv(GL_FRONT, GL_SHININESS, &oldShiny);
-
-    glPushMatrix();
-
-    //-----------------------------------------------
-    //  1.  Build the string to display <-- parameter
-    //-----------------------------------------------
-    int infoLn = (int) strlen(infoStr);
-
-    //-----------------------------------------------
-    //  2.  Determine the string's length (in pixels)
-    //-----------------------------------------------
-    int textWidth = 0;
-    for (int k=0; k<infoLn; k++)
+	GLuint& lists = isLarge ? largeFontLists : smallFontLists;
+	if (lists == 0)
 	{
-		if (isLarge)
-			textWidth += glutBitmapWidth(LARGE_DISPLAY_FONT, infoStr[k]);
-		else
-			textWidth += glutBitmapWidth(SMALL_DISPLAY_FONT, infoStr[k]);
-		
-    }
-	//  add a few pixels of padding
-    textWidth += 2*TEXT_PADDING;
-
-	//	The text width variable and FONT_HEIGHT constants are used in some apps
-	//	where I display text over a colored background.  They are not needed here
-	//	but I didn't want to completely remove them
-	(void) textWidth;
-	(void) SMALL_FONT_HEIGHT;
-	(void) LARGE_FONT_HEIGHT;
-		
-    //-----------------------------------------------
-    //  4.  Draw the string
-    //-----------------------------------------------
-    glColor4fv(kTextColor);
-    int x = xPos;
-    for (int k=0; k<infoLn; k++)
-    {
-        glRasterPos2i(x, yPos);
-		if (isLarge)
-		{
-			glutBitmapCharacter(LARGE_DISPLAY_FONT, infoStr[k]);
-			x += glutBitmapWidth(LARGE_DISPLAY_FONT, infoStr[k]);
-		}
-		else
+		lists = glGenLists(NUM_FONT_LISTS);
+		for (int c=0; c<NUM_FONT_LISTS; c++)
 		{
-			glutBitmapCharacter(SMALL_DISPLAY_FONT, infoStr[k]);
-			x += glutBitmapWidth(SMALL_DISPLAY_FONT, infoStr[k]);
+			glNewList(lists + c, GL_COMPILE);
+			if (isLarge)
+				glutBitmapCharacter(LARGE_DISPLAY_FONT, c);
+			else
+				glutBitmapCharacter(SMALL_DISPLAY_FONT, c);
+			glEndList();
 		}
 	}
+	return lists;
+}
+
+void displayTextualInfo(const char* infoStr, int xPos, int yPos, int isLarge)
+{
+	glColor4fv(kTextColor);
+	glRasterPos2i(xPos, yPos);
+	glListBase(fontLists(isLarge));
+	glCallLists(static_cast<GLsizei>(strlen(infoStr)), GL_UNSIGNED_BYTE, infoStr);
+}
+
+//	A label of the state pane, only reformatted when the value it shows changes
+struct CachedLabel {
+						const char* format;
+						int value = 0;
+						bool isSet = false;
+						char text[64] = {};
+};
 
-    //-----------------------------------------------
-    //  5.  Restore old material properties
-    //-----------------------------------------------
-	glMaterialfv(GL_FRONT, GL_AMBIENT, oldAmb);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE, oldDif);
-	glMaterialfv(GL_FRONT, GL_SPECULAR, oldSpec);
-	glMaterialf(GL_FRONT, GL_SHININESS, oldShiny);
-    
-    //-----------------------------------------------
-    //  6.  Restore reference frame
-    //-----------------------------------------------
-    glPopMatrix();
+const char* labelText(CachedLabel& label, int value)
+{
+	if (!label.isSet || label.value != value)
+	{
+		snprintf(label.text, sizeof(label.text), label.format, value);
+		label.value = value;
+		label.isSet = true;
+	}
+	return label.text;
 }
 
 void drawState(int numLiveThreads, int redLevel, int greenLevel, int blueLevel)
@@ -374,22 +737,21 @@ void drawState(int numLiveThreads, int redLevel, int greenLevel, int blueLevel)
 	drawnTankFrame(LEVEL_WIDTH, LEVEL_HEIGHT);
 	glPopMatrix();
 	
-	//	Build, then display text info for the red, green, and blue tanks
-	char infoStr[256];
-	sprintf(infoStr, "Red level: %d", redLevel);
-	displayTextualInfo(infoStr, RED_LEFT, LEVEL_TXT_Y, 0);
-	sprintf(infoStr, "Green level: %d", greenLevel);
-	displayTextualInfo(infoStr, GREEN_LEFT, LEVEL_TXT_Y, 0);
-	sprintf(infoStr, "Blue level: %d", blueLevel);
-	displayTextualInfo(infoStr, BLUE_LEFT, LEVEL_TXT_Y, 0);
-	sprintf(infoStr, "Max level: %d", MAX_LEVEL);
-	displayTextualInfo(infoStr, RED_LEFT, MAX_LEVEL_TXT_Y, 0);
-	displayTextualInfo(infoStr, GREEN_LEFT, MAX_LEVEL_TXT_Y, 0);
-	displayTextualInfo(infoStr, BLUE_LEFT, MAX_LEVEL_TXT_Y, 0);
+	//	Display text info for the red, green, and blue tanks (the strings are
+	//	only rebuilt when the values change)
+	static CachedLabel redLabel = {"Red level: %d"}, greenLabel = {"Green level: %d"},
+					   blueLabel = {"Blue level: %d"}, maxLabel = {"Max level: %d"},
+					   liveLabel = {"Live Threads: %d"};
+	displayTextualInfo(labelText(redLabel, redLevel), RED_LEFT, LEVEL_TXT_Y, 0);
+	displayTextualInfo(labelText(greenLabel, greenLevel), GREEN_LEFT, LEVEL_TXT_Y, 0);
+	displayTextualInfo(labelText(blueLabel, blueLevel), BLUE_LEFT, LEVEL_TXT_Y, 0);
+	const char* maxStr = labelText(maxLabel, MAX_LEVEL);
+	displayTextualInfo(maxStr, RED_LEFT, MAX_LEVEL_TXT_Y, 0);
+	displayTextualInfo(maxStr, GREEN_LEFT, MAX_LEVEL_TXT_Y, 0);
+	displayTextualInfo(maxStr, BLUE_LEFT, MAX_LEVEL_TXT_Y, 0);
 	
 	//	display info about number of live threads
-	sprintf(infoStr, "Live Threads: %d", numLiveThreads);
-	displayTextualInfo(infoStr, RED_LEFT, TOP_LEVEL_TXT_Y, 1);
+	displayTextualInfo(labelText(liveLabel, numLiveThreads), RED_LEFT, TOP_LEVEL_TXT_Y, 1);
 }
 
 
@@ -415,6 +777,9 @@ void myResize(int w, int h)
 
 void myDisplay(void)
 {
+	//	read before drawing, so changes made while we draw trigger the next frame
+	lastDrawnGeneration = simulationGeneration.load(std::memory_order_relaxed);
+
     glutSetWindow(gMainWindow);
 
     glMatrixMode(GL_MODELVIEW);
@@ -436,6 +801,38 @@ void myMouse(int button, int state, int x, int y)
 	glutPostRedisplay();
 }
 
+//	Zooms the view by factor (< 1 zooms in), keeping the cell under pixel (x, y)
+//	of the grid pane where it is
+void zoomView(float factor, int x, int y)
+{
+	const int numRows = gridLevels[0].rows, numCols = gridLevels[0].cols;
+	const float cellRow = viewRow0 + y * viewRows / static_cast<float>(GRID_PANE_HEIGHT),
+				cellCol = viewCol0 + x * viewCols / static_cast<float>(GRID_PANE_WIDTH);
+
+	viewRows = max(min(static_cast<int>(lroundf(viewRows * factor)), numRows), min(MIN_VIEW_CELLS, numRows));
+	viewCols = max(min(static_cast<int>(lroundf(viewCols * factor)), numCols), min(MIN_VIEW_CELLS, numCols));
+	setViewOrigin(static_cast<int>(lroundf(cellRow - y * viewRows / static_cast<float>(GRID_PANE_HEIGHT))),
+				  static_cast<int>(lroundf(cellCol - x * viewCols / static_cast<float>(GRID_PANE_WIDTH))));
+}
+
+//	Moves the view's top-left cell, keeping the view inside the grid
+void setViewOrigin(int row0, int col0)
+{
+	viewRow0 = max(0, min(row0, gridLevels[0].rows - viewRows));
+	viewCol0 = max(0, min(col0, gridLevels[0].cols - viewCols));
+	markSimulationChanged();
+}
+
+void setTravelerQueryFunc(void (*queryCB)(int rowMin, int colMin, int rowMax, int colMax, std::vector<int>& ids))
+{
+	travelerQueryFunc = queryCB;
+}
+
+void setTimerFunc(void (*timerCB)(void))
+{
+	timerFunc = timerCB;
+}
+
 //	This function is called when a mouse event occurs in the grid pane
 //
 void myGridPaneMouse(int button, int state, int x, int y)
@@ -445,14 +842,41 @@ void myGridPaneMouse(int button, int state, int x, int y)
 		case GLUT_LEFT_BUTTON:
 			if (state == GLUT_DOWN)
 			{
-				//	do something
+				//	this may be the start of a drag
+				dragX = x;
+				dragY = y;
+				dragRow0 = viewRow0;
+				dragCol0 = viewCol0;
+				dragMoved = false;
 			}
 			else if (state == GLUT_UP)
 			{
-				//	exit(0);
+				if (!dragMoved)
+					zoomView(0.5f, x, y);
 			}
 			break;
 			
+		case GLUT_RIGHT_BUTTON:
+			if (state == GLUT_DOWN)
+				zoomView(2.f, x, y);
+			break;
+
+		case GLUT_MIDDLE_BUTTON:
+			if (state == GLUT_DOWN)
+			{
+				viewRows = gridLevels[0].rows;
+				viewCols = gridLevels[0].cols;
+				setViewOrigin(0, 0);
+			}
+			break;
+
+		//	scroll wheel, for the glut implementations that report it as buttons
+		case 3:
+		case 4:
+			if (state == GLUT_DOWN)
+				zoomView(button == 3 ? 0.8f : 1.25f, x, y);
+			break;
+
 		default:
 			break;
 	}
@@ -461,6 +885,22 @@ void myGridPaneMouse(int button, int state, int x, int y)
 	glutPostRedisplay();
 }
 
+//	This function is called when the mouse moves in the grid pane with a button down
+//
+void myGridPaneMotion(int x, int y)
+{
+	if (abs(x - dragX) + abs(y - dragY) > DRAG_THRESHOLD)
+		dragMoved = true;
+
+	if (dragMoved)
+	{
+		setViewOrigin(dragRow0 - (y - dragY) * viewRows / GRID_PANE_HEIGHT,
+					  dragCol0 - (x - dragX) * viewCols / GRID_PANE_WIDTH);
+		glutSetWindow(gMainWindow);
+		glutPostRedisplay();
+	}
+}
+
 //	This function is called when a mouse event occurs in the state pane
 void myStatePaneMouse(int button, int state, int x, int y)
 {
@@ -511,17 +951,17 @@ void myKeyboard(unsigned char c, int x, int y)
 
 		//	Test red ink up/down
 		case 'r':
-			ok = refillRedInk(MAX_ADD_INK);
+			ok = requestRefill(RED_TRAV, MAX_ADD_INK);
 			break;
 
 		//	Test green ink up/down
 		case 'g':
-			ok = refillGreenInk(MAX_ADD_INK);
+			ok = requestRefill(GREEN_TRAV, MAX_ADD_INK);
 			break;
 
 		//	Test blue ink up/down
 		case 'b':
-			ok = refillBlueInk(MAX_ADD_INK);
+			ok = requestRefill(BLUE_TRAV, MAX_ADD_INK);
 			break;
 			
 		case '.':
@@ -550,7 +990,7 @@ void myTimer(int val)
 	// "I" am the main thread, which has been taken over by glut.
 	
 	//	I re-prime the timer
-	glutTimerFunc(10, myTimer, val);
+	glutTimerFunc(max(1, 1000 / MAX_FPS), myTimer, val);
 	//			 ^^^       ^    ^
 	//			  |        |    |
 	//	in that --+  call -+    +--- and pass along this value (e.g. we could use
@@ -559,8 +999,13 @@ void myTimer(int val)
     //  possibly do something to update the scene, but really this should be done
     //	by the computation threads.  I am just a rendering thread taking pictures.
 
-	//	And finally I perform the rendering (take a picture)
-	myDisplay();
+	if (timerFunc != nullptr)
+		timerFunc();
+
+	//	And finally I perform the rendering (take a picture), if there is
+	//	anything new to take a picture of
+	if (simulationGeneration.load(std::memory_order_relaxed) != lastDrawnGeneration)
+		myDisplay();
 }
 
 void myMenuHandler(int choice)
@@ -603,7 +1048,7 @@ void initializeFrontEnd(int argc, char** argv, void (*gridDisplayCB)(void),
 	glutDisplayFunc(myDisplay);
 	glutReshapeFunc(myResize);
 	glutMouseFunc(myMouse);
-	glutTimerFunc(10, myTimer, 0);
+	glutTimerFunc(max(1, 1000 / MAX_FPS), myTimer, 0);
 	
 	gridDisplayFunc = gridDisplayCB;
 	stateDisplayFunc = stateDisplayCB;
@@ -619,6 +1064,7 @@ void initializeFrontEnd(int argc, char** argv, void (*gridDisplayCB)(void),
 	glClearColor(0.f, 0.f, 0.f, 1.f);
 	glutKeyboardFunc(myKeyboard);
 	glutMouseFunc(myGridPaneMouse);
+	glutMotionFunc(myGridPaneMotion);
 	glutDisplayFunc(gridDisplayCB);
 	
 	
@@ -632,6 +1078,6 @@ void initializeFrontEnd(int argc, char** argv, void (*gridDisplayCB)(void),
 	glOrtho(0.0f, STATE_PANE_WIDTH, 0.0f, STATE_PANE_HEIGHT, -1, 1);
 	glClearColor(0.f, 0.f, 0.f, 1.f);
 	glutKeyboardFunc(myKeyboard);
-	glutMouseFunc(myGridPaneMouse);
+	glutMouseFunc(myStatePaneMouse);
 	glutDisplayFunc(stateDisplayCB);
 }
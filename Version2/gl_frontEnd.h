@@ -53,8 +53,13 @@ struct TravelerInfo {
 //	Function prototypes
 //-----------------------------------------------------------------------------
 
-void drawGrid(int**grid, int numRows, int numCols);
-void drawGridAndTravelers(int**grid, int numRows, int numCols, std::vector<TravelerInfo>& travelerList);
+void drawGrid(void);
+void drawGridAndTravelers(std::vector<TravelerInfo>& travelerList);
+void markSimulationChanged(void);
+void initializeGridRendering(int** grid, int numRows, int numCols);
+void setTravelerQueryFunc(void (*queryCB)(int rowMin, int colMin, int rowMax, int colMax, std::vector<int>& ids));
+void setTimerFunc(void (*timerCB)(void));
+void markGridCellDirty(int row, int col);
 void drawState(int numLiveThreads, int redLevel, int greenLevel, int blueLevel);
 void initializeFrontEnd(int argc, char** argv, void (*gridCB)(void), void (*stateCB)(void));
 void cleanupAndQuit();
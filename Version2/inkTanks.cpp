@@ -0,0 +1,107 @@
+//
+//  inkTanks.cpp
+//
+
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+	#include <linux/futex.h>
+	#include <sys/syscall.h>
+#endif
+//
+#include "inkTanks.h"
+
+using namespace std;
+
+static_assert(sizeof(atomic<int32_t>) == sizeof(int32_t), "a tank level must be usable as a futex");
+
+//	Every process using the tanks maps the same segment, whoever comes first
+//	creates it and fills it
+InkTanks* mapInkTanks(const char* name, const int initialLevels[NUM_INK_TANKS])
+{
+	const int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0)
+		return nullptr;
+	if (ftruncate(fd, sizeof(InkTanks)) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	void* segment = mmap(nullptr, sizeof(InkTanks), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED)
+		return nullptr;
+
+	InkTanks* inkTanks = static_cast<InkTanks*>(segment);
+	uint32_t expected = 0;
+	if (inkTanks->initialized.compare_exchange_strong(expected, 1))
+	{
+		for (int k = 0; k < NUM_INK_TANKS; k++)
+			addInk(inkTanks, k, initialLevels[k], INT_MAX);
+	}
+	return inkTanks;
+}
+
+void unmapInkTanks(InkTanks* inkTanks)
+{
+	munmap(inkTanks, sizeof(InkTanks));
+}
+
+bool takeInk(InkTanks* inkTanks, int tank, int amount)
+{
+	atomic<int32_t>& level = inkTanks->tanks[tank].level;
+	int32_t current = level.load(memory_order_relaxed);
+	do
+	{
+		if (current < amount)
+			return false;
+	}
+	while (!level.compare_exchange_weak(current, current - amount, memory_order_acquire, memory_order_relaxed));
+	return true;
+}
+
+//	Wakes up whoever sleeps on the tank, in any process
+bool addInk(InkTanks* inkTanks, int tank, int amount, int maxLevel)
+{
+	InkTanks::Tank& theTank = inkTanks->tanks[tank];
+	int32_t current = theTank.level.load(memory_order_relaxed);
+	do
+	{
+		if (current + amount > maxLevel)
+			return false;
+	}
+	while (!theTank.level.compare_exchange_weak(current, current + amount, memory_order_seq_cst, memory_order_relaxed));
+
+#if defined(__linux__)
+	if (theTank.numWaiters.load(memory_order_seq_cst) > 0)
+		syscall(SYS_futex, reinterpret_cast<int32_t*>(&theTank.level), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+	return true;
+}
+
+int inkLevel(InkTanks* inkTanks, int tank)
+{
+	return inkTanks->tanks[tank].level.load(memory_order_relaxed);
+}
+
+//	Sleep until the tank isn't empty anymore, or for at most timeout
+//	microseconds.  Elsewhere than on Linux, just sleep for 1 ms
+void waitForInk(InkTanks* inkTanks, int tank, int timeout)
+{
+#if defined(__linux__)
+	InkTanks::Tank& theTank = inkTanks->tanks[tank];
+	theTank.numWaiters.fetch_add(1, memory_order_seq_cst);
+	const int32_t current = theTank.level.load(memory_order_seq_cst);
+	if (current <= 0)
+	{
+		struct timespec wait = {timeout / 1000000, (timeout % 1000000) * 1000};
+		syscall(SYS_futex, reinterpret_cast<int32_t*>(&theTank.level), FUTEX_WAIT, current, &wait, nullptr, 0);
+	}
+	theTank.numWaiters.fetch_sub(1, memory_order_relaxed);
+#else
+	usleep(1000);
+#endif
+}
@@ -0,0 +1,41 @@
+//
+//  inkTanks.h
+//
+
+#ifndef INK_TANKS_H
+#define INK_TANKS_H
+
+#include <atomic>
+#include <cstdint>
+
+//-----------------------------------------------------------------------------
+//	Ink tanks shared by several travel processes.
+//
+//	With --shared-ink <name>, a process takes and adds its ink in a shared
+//	memory segment instead of its own tanks, so that the travelers of every
+//	process using the same name draw from one pool that all their producers
+//	refill.  The levels only change through compare-and-swap loops.  A
+//	traveler facing an empty tank sleeps on the level itself (a futex on
+//	Linux) until a producer adds ink.
+//-----------------------------------------------------------------------------
+
+const int NUM_INK_TANKS = 3;
+
+struct InkTanks {
+						//	0 until the first process has filled the tanks
+						std::atomic<uint32_t> initialized;
+						//	one cache line per tank, as each is contended on its own
+						struct alignas(64) Tank {
+							std::atomic<int32_t> level;
+							std::atomic<uint32_t> numWaiters;
+						} tanks[NUM_INK_TANKS];
+};
+
+InkTanks* mapInkTanks(const char* name, const int initialLevels[NUM_INK_TANKS]);
+void unmapInkTanks(InkTanks* inkTanks);
+bool takeInk(InkTanks* inkTanks, int tank, int amount);
+bool addInk(InkTanks* inkTanks, int tank, int amount, int maxLevel);
+int inkLevel(InkTanks* inkTanks, int tank);
+void waitForInk(InkTanks* inkTanks, int tank, int timeout);
+
+#endif // INK_TANKS_H
@@ -0,0 +1,134 @@
+//
+//  instrumentedMutex.h
+//
+
+#ifndef INSTRUMENTED_MUTEX_H
+#define INSTRUMENTED_MUTEX_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+//-----------------------------------------------------------------------------
+//	A named std::mutex that counts its acquisitions, how many of them found it
+//	taken, and how long they waited for it and held it, for the stats command
+//	and the table printed at exit.  The mutexes are meant to be globals: each
+//	one registers itself for the table and stays registered.
+//
+//	Build with -DLOCK_STATS=0 to get a plain std::mutex back: the counters,
+//	the clock reads and the registration all go away, and the table is empty.
+//-----------------------------------------------------------------------------
+
+#if !defined(LOCK_STATS)
+	#define LOCK_STATS 1
+#endif
+
+//	how many mutexes the table can hold; the others are not registered
+const int MAX_INSTRUMENTED_MUTEXES = 32;
+
+#if LOCK_STATS
+
+class InstrumentedMutex
+{
+	public:
+		explicit InstrumentedMutex(const char* lockName);
+
+		void lock(void)
+		{
+			if (theMutex.try_lock())
+			{
+				acquired(0);
+				return;
+			}
+			const auto start = std::chrono::steady_clock::now();
+			theMutex.lock();
+			const auto now = std::chrono::steady_clock::now();
+			numContended.fetch_add(1, std::memory_order_relaxed);
+			acquired(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count(), now);
+		}
+
+		bool try_lock(void)
+		{
+			if (!theMutex.try_lock())
+				return false;
+			acquired(0);
+			return true;
+		}
+
+		void unlock(void)
+		{
+			const long hold = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - lockTime).count();
+			theMutex.unlock();
+			totalHold.fetch_add(hold, std::memory_order_relaxed);
+			raise(maxHold, hold);
+		}
+
+		const char* name(void) const { return lockName; }
+		long acquisitions(void) const { return numAcquisitions.load(std::memory_order_relaxed); }
+		long contended(void) const { return numContended.load(std::memory_order_relaxed); }
+		//	in nanoseconds
+		long waitTime(void) const { return totalWait.load(std::memory_order_relaxed); }
+		long maxWaitTime(void) const { return maxWait.load(std::memory_order_relaxed); }
+		long holdTime(void) const { return totalHold.load(std::memory_order_relaxed); }
+		long maxHoldTime(void) const { return maxHold.load(std::memory_order_relaxed); }
+
+	private:
+		void acquired(long wait, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+		{
+			//	only the holder touches lockTime
+			lockTime = now;
+			numAcquisitions.fetch_add(1, std::memory_order_relaxed);
+			if (wait > 0)
+			{
+				totalWait.fetch_add(wait, std::memory_order_relaxed);
+				raise(maxWait, wait);
+			}
+		}
+
+		static void raise(std::atomic<long>& maximum, long value)
+		{
+			long current = maximum.load(std::memory_order_relaxed);
+			while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+				;
+		}
+
+		std::mutex theMutex;
+		const char* lockName;
+		std::chrono::steady_clock::time_point lockTime;
+		std::atomic<long> numAcquisitions{0}, numContended{0};
+		std::atomic<long> totalWait{0}, maxWait{0}, totalHold{0}, maxHold{0};
+};
+
+#else
+
+class InstrumentedMutex
+{
+	public:
+		explicit InstrumentedMutex(const char* lockName) : lockName(lockName) {}
+
+		void lock(void) { theMutex.lock(); }
+		bool try_lock(void) { return theMutex.try_lock(); }
+		void unlock(void) { theMutex.unlock(); }
+
+		const char* name(void) const { return lockName; }
+		long acquisitions(void) const { return 0; }
+		long contended(void) const { return 0; }
+		long waitTime(void) const { return 0; }
+		long maxWaitTime(void) const { return 0; }
+		long holdTime(void) const { return 0; }
+		long maxHoldTime(void) const { return 0; }
+
+	private:
+		std::mutex theMutex;
+		const char* lockName;
+};
+
+#endif
+
+//	one row per registered mutex, times in ms
+std::string lockStatsTable(void);
+//	"name":{...} for each registered mutex, comma separated
+std::string lockStatsJson(void);
+
+#endif // INSTRUMENTED_MUTEX_H
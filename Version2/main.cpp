@@ -2,7 +2,7 @@
 //  main.cpp
 //  GL travelers
 
-// g++ -Wall -std=c++20 main.cpp gl_frontEnd.cpp -framework OpenGL -framework GLUT -o travel
+// g++ -Wall -std=c++20 main.cpp gl_frontEnd.cpp frameCapture.cpp controlServer.cpp controlBlock.cpp zygote.cpp domain.cpp inkTanks.cpp sharedGrid.cpp commandScript.cpp commandQueue.cpp instrumentedMutex.cpp -framework OpenGL -framework GLUT -o travel
 
  /*-------------------------------------------------------------------------+
  |	A graphic front end for a grid+state simulation.						|
@@ -22,21 +22,72 @@
  |		- 'r' --> add red ink												|
  |		- 'g' --> add green ink												|
  |		- 'b' --> add blue ink												|
+ |		- left/right click in the grid --> zoom in/out						|
+ |		- drag in the grid --> pan, middle click --> whole grid				|
+ |																			|
+ |	With --headless, no window is opened: the simulation runs on its own	|
+ |	until --duration seconds or --steps traveler moves have elapsed.		|
+ |	In either mode, --frames <dir> records the grid every --frame-period	|
+ |	ms as PPM images, raw RGB frames or one RGB stream (--frame-format).	|
+ |																			|
+ |	Commands (r, g, b, end, and + - . , as on the keyboard) are read one	|
+ |	per line from the pipe, and also from any --control-fifo, clients of	|
+ |	the --control-socket Unix socket, and stdin with --control-stdin.		|
+ |	'stats' replies with one line of JSON: to a socket client on its		|
+ |	connection, on stdout for stdin, and on the --reply-fifo for FIFOs.		|
+ |	It includes the counts and times of every mutex, whose table is also	|
+ |	printed at exit (see instrumentedMutex.h, -DLOCK_STATS=0 to disable).	|
+ |	Clients of --control-binary-socket speak controlProtocol.h instead.		|
+ |	The same requests can be written into shared memory, without system	|
+ |	calls, with --control-shm and --control-broadcast (controlBlock.h).		|
+ |	Whatever their source, changes to the simulation are queued and made	|
+ |	by the main thread between two frames (see commandQueue.h).				|
+ |																			|
+ |	--script <file> replays timed commands (see commandScript.h), and		|
+ |	--seed <n> makes the random choices start from a fixed state.			|
+ |																			|
+ |	'travel --zygote <socket>' starts nothing itself: it forks an instance	|
+ |	for each command line written to the socket (see zygote.h).				|
+ |																			|
+ |	With --domain <name> --partition <k>/<n>, the grid is shared by n		|
+ |	processes, each simulating its own strip of rows (see domain.h).		|
+ |	With --shared-ink <name>, processes draw from the same ink tanks.		|
+ |	With --publish <name>, the grid, travelers and ink levels are copied	|
+ |	to shared memory for travel-viewer (see sharedGrid.h).					|
  +-------------------------------------------------------------------------*/
 
 #include <thread>
 #include <random>
 #include <vector>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <unistd.h>
 #include <iostream>
 #include <tuple>
-#include <fstream>
 #include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <sstream>
+#include <iomanip>
+#include <deque>
+#include <functional>
 //
 #include "glPlatform.h"
 #include "gl_frontEnd.h"
+#include "frameCapture.h"
+#include "controlServer.h"
+#include "controlProtocol.h"
+#include "controlBlock.h"
+#include "zygote.h"
+#include "domain.h"
+#include "inkTanks.h"
+#include "sharedGrid.h"
+#include "commandScript.h"
+#include "instrumentedMutex.h"
+#include "commandQueue.h"
 
 using namespace std;
 
@@ -46,17 +97,37 @@ using namespace std;
 void displayGridPane(void);
 void displayStatePane(void);
 void initializeApplication(void);
+int runTravel(int argc, char** argv);
 
 //==================================================================================
 //	Application-level global variables
 //==================================================================================
 void makeTravelers();
 void travelerThreadFunc(TravelerInfo *traveler);
+void arrivingTravelerThreadFunc(TravelerInfo *traveler, int targetRow, int targetCol);
+bool moveTraveler(TravelerInfo *traveler, TravelDirection newDir, int newRow, int newCol);
+bool killRequested(const TravelerInfo *traveler);
+bool takeStepInk(TravelerInfo *traveler);
+void handOffTraveler(TravelerInfo *traveler, int newRow, int newCol);
+void receiveTraveler(const TravelerHandoff& handoff);
+void pollDomain(void);
+bool colorTrailOut(TravelerInfo *traveler);
 void colorTrailUp(TravelerInfo *traveler);
 void colorTrailDown(TravelerInfo *traveler);
 void colorTrailLeft(TravelerInfo *traveler);
 void colorTrailRight(TravelerInfo *traveler);
 
+bool acquireSharedInk(int type, int amount);
+bool refillSharedInk(int type, int amount);
+int currentInkLevel(int type);
+void waitForTankRefill(int type);
+
+bool queueSimulationCommand(int op, int arg0 = 0, int arg1 = 0);
+std::function<bool(void)> commandsApplied(void);
+bool requestRefill(TravelerType type, int amount);
+void drainSimulationCommands(void);
+void applyPendingRefills(void);
+
 void faster();
 void slower();
 
@@ -67,7 +138,19 @@ void producerRedThreadFunc();
 void producerGreenThreadFunc();
 void producerBlueThreadFunc();
 
-void readPipe(std::string pipePath);
+void handleCommand(std::string command, std::string& replies);
+void handleScriptCommand(std::string command);
+std::string statsJson(void);
+void handleSocketMessage(const char* message, size_t length, std::string& replies);
+void handleMessage(const char* message, size_t length, std::string& replies);
+int controlIdle(void);
+int earliestTimeout(int timeout1, int timeout2);
+void pollControlBlocks(void);
+int spawnTraveler(int type);
+
+void runHeadless(void);
+void captureThreadFunc();
+void publishThreadFunc();
 
 std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection newDir, int newRow, int newCol);
 
@@ -75,11 +158,24 @@ std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection
 extern int	GRID_PANE, STATE_PANE;
 extern int	gMainWindow, gSubwindow[2];
 bool DRAW_COLORED_TRAVELER_HEADS = true;
+//	upper bound on the redraw rate; frames are only drawn when something changed
+int MAX_FPS = 100;
 
 //	The state grid and its dimensions
 int** grid;
 int num_rows = 20, num_cols = 20;
 
+//	In a domain, grid only holds rows rowOffset to rowOffset + num_rows - 1 of
+//	a globalRows-row grid, and the travelers' rows are relative to rowOffset.
+//	Handed-off travelers leave their slot in travelerList to the next one that
+//	comes in (their thread is done once its index is in freeTravelerSlots).
+std::string domainShmName;
+DomainBlock* domainBlock = nullptr;
+int domainPartition = 0, numPartitions = 1;
+int rowOffset = 0, globalRows = 20;
+std::vector<int> freeTravelerSlots;
+InstrumentedMutex handoffLock("handoff");
+
 //	the number of live threads (that haven't terminated yet)
 int num_threads = 10;
 int numLiveThreads = 0;
@@ -87,32 +183,140 @@ int numLiveThreads = 0;
 //	the ink levels
 int MAX_LEVEL = 50;
 int MAX_ADD_INK = 10;
-int redLevel = 20, greenLevel = 30, blueLevel = 40;
+//	each one is changed under its tank's lock (redInkLock...), travelers and
+//	refills alike, and read without it
+std::atomic<int> redLevel(20), greenLevel(30), blueLevel(40);
+//	shared tanks used instead of these, and how long a traveler sleeps at most
+//	on an empty one (in microseconds)
+std::string inkShmName;
+InkTanks* inkTanks = nullptr;
+const int INK_WAIT_TIMEOUT = 10000;
 
 //	ink producer sleep time (in microseconds)
 //	[min sleep time is arbitrary]
 const int MIN_SLEEP_TIME = 30000;
-int producerSleepTime = 100000;
+std::atomic<int> producerSleepTime(100000);
 
 // Define the color increment
 int colorIncrement = 32;
 
 vector<TravelerInfo> travelerList;
 std::vector<std::thread> travelerThreads;
+//	One per slot of travelerList.  Only a traveler's own thread writes its
+//	isLive once it runs: a kill request asks it to stop before its next step,
+//	and is acked once its thread marks the slot stopped.
+enum TravelerState {
+						TRAVELER_RUNNING = 0,
+						TRAVELER_KILL_REQUESTED,
+						TRAVELER_STOPPED
+};
+std::atomic<int>* travelerStates = nullptr;
+//	travelerList has room for this many more travelers from spawn requests, so
+//	that the traveler threads' pointers into it stay valid.  Spawning holds
+//	spawnLock, which cleanupAndQuit waits on before joining the threads.
+const int MAX_SPAWNED_TRAVELERS = 256;
+InstrumentedMutex spawnLock("spawn");
 
 std::vector<std::thread> producerRedThreads;
 std::vector<std::thread> producerGreenThreads;
 std::vector<std::thread> producerBlueThreads;
 
-std::mutex gridLock, redInkLock, blueInkLock, greenInkLock, refillRedLock, refillBlueLock, refillGreenLock;
+//	they count how often and how long they are waited for and held (see
+//	statsJson and cleanupAndQuit)
+InstrumentedMutex gridLock("grid");
+InstrumentedMutex redInkLock("redInk"), greenInkLock("greenInk"), blueInkLock("blueInk");
 
 const int CORNER_DISTANCE = 1;
-unsigned int stime = 500000;
+std::atomic<unsigned int> stime(500000);
 
 random_device myRandDev;
 default_random_engine myEngine(myRandDev());
 
 std::string pipePath = "/tmp/travpipe";
+//	commands replayed by the control thread, timed from its start
+std::string scriptPath;
+CommandScript commandScript;
+//	where 'stats' replies to the commands read from FIFOs
+std::string replyFifo;
+//	what 'stats' reports besides the simulation state (times in microseconds),
+//	and the moves at the previous query, for the rate since then
+std::chrono::steady_clock::time_point startTime, lastStatsTime;
+long lastStatsMoves = 0;
+std::atomic<long> inkStallTime(0);
+std::atomic<long> numFrames(0), frameTime(0), maxFrameTime(0);
+//	--seed replaces the random seed, for runs that start the same way
+bool fixedSeed = false;
+unsigned int seed = 0;
+//	additional command sources for the control server
+std::vector<std::string> controlFifos;
+std::string controlSocket;
+std::string controlBinarySocket;
+bool controlStdin = false;
+//	set by an end request, so that the replies already collected get sent
+//	before controlIdle quits
+bool endRequested = false;
+//	shared-memory control: this process's block, the broadcast slot shared by
+//	all processes, and how often the control thread looks at them (in ms)
+std::string controlShmName, broadcastShmName;
+ControlBlock* controlBlock = nullptr;
+BroadcastBlock* broadcastBlock = nullptr;
+//	broadcasts carried out or lost, counted from when we mapped the block
+uint32_t numBroadcastsSeen = 0, numBroadcastsLost = 0;
+const int CONTROL_BLOCK_POLL_TIMEOUT = 1;
+//	What the keyboard and the command sources ask of the simulation.  Whatever
+//	thread they come from, they go through simulationCommands and are carried
+//	out by the main thread between two frames (see drainSimulationCommands).
+enum SimulationCommandOp {
+						//	args: traveler type, amount of ink
+						SIM_REFILL = 0,
+						SIM_FASTER,
+						SIM_SLOWER,
+						SIM_SPEEDUP_PRODUCERS,
+						SIM_SLOWDOWN_PRODUCERS,
+						//	arg: sleep time in microseconds
+						SIM_SET_TRAVELER_SPEED,
+						SIM_SET_PRODUCER_PERIOD
+};
+CommandQueue simulationCommands;
+//	refills whose ink doesn't fit in the tank yet, retried at every drain
+//	(main thread only)
+std::vector<QueuedCommand> pendingRefills;
+//	how many queued commands the main thread has carried out, so that binary
+//	requests are only acked once they took effect
+std::atomic<uint32_t> numAppliedCommands(0);
+//	what the ack of the binary request being handled waits for, if anything
+std::function<bool(void)> ackCondition;
+//	acks of the control block's requests, published in order once they can go
+struct BlockAck {
+						uint32_t seq;
+						uint32_t status;
+						std::function<bool(void)> ready;
+};
+std::deque<BlockAck> blockAcks;
+
+//	set by cleanupAndQuit to get all simulation threads to return
+std::atomic<bool> stopSimulation(false);
+//	total number of cells traveled, all travelers included
+std::atomic<long> numMoves(0);
+
+//	headless mode: no GLUT window, stop after runDuration seconds or maxSteps
+//	moves (0 means no limit)
+bool headless = false;
+double runDuration = 0;
+long maxSteps = 0;
+//	frame capture: a snapshot of the grid every framePeriod ms goes into a
+//	queue of frameQueueSize buffers drained by the encoder thread
+std::string frameDir;
+int framePeriod = 100;
+CaptureFormat frameFormat = CAPTURE_PPM;
+int frameQueueSize = 8;
+std::thread captureThread;
+//	the shared snapshot of the simulation for travel-viewer
+std::string publishName;
+SharedGridHeader* sharedGrid = nullptr;
+std::thread publishThread;
+//	how often the headless main thread and the capture thread wake up (in microseconds)
+const int HEADLESS_POLL_TIME = 10000;
 //==================================================================================
 //	These are the functions that tie the simulation with the rendering.
 //	Some parts are "don't touch."  Other parts need your intervention
@@ -134,9 +338,15 @@ void displayGridPane(void)
 	//	You *must* synchronize this call.
 	//---------------------------------------------------------
 	//	Use this drawing call instead
+	const auto start = std::chrono::steady_clock::now();
 	gridLock.lock();
-	drawGridAndTravelers(grid, num_rows, num_cols, travelerList);
+	drawGridAndTravelers(travelerList);
 	gridLock.unlock();
+	const long drawTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	frameTime += drawTime;
+	if (drawTime > maxFrameTime)
+		maxFrameTime = drawTime;
+	numFrames++;
 
 	//	This is OpenGL/glut magic.  Don't touch
 	glutSwapBuffers();	
@@ -158,7 +368,7 @@ void displayStatePane(void)
 	//	You *must* synchronize this call.
 	//
 	//---------------------------------------------------------
-	drawState(numLiveThreads, redLevel, greenLevel, blueLevel);
+	drawState(numLiveThreads, currentInkLevel(RED_TRAV), currentInkLevel(GREEN_TRAV), currentInkLevel(BLUE_TRAV));
 		
 	//	This is OpenGL/glut magic.  Don't touch
 	glutSwapBuffers();	
@@ -173,12 +383,15 @@ void displayStatePane(void)
 //
 bool acquireRedInk(int theRed)
 {
+	if (inkTanks != nullptr)
+		return acquireSharedInk(RED_TRAV, theRed);
 	bool ok = false;
 	redInkLock.lock();
 	if (redLevel >= theRed)
 	{
 		redLevel -= theRed;
 		ok = true;
+		markSimulationChanged();
 	}
 	redInkLock.unlock();
 	return ok;
@@ -186,12 +399,15 @@ bool acquireRedInk(int theRed)
 
 bool acquireGreenInk(int theGreen)
 {
+	if (inkTanks != nullptr)
+		return acquireSharedInk(GREEN_TRAV, theGreen);
 	bool ok = false;
 	greenInkLock.lock();
 	if (greenLevel >= theGreen)
 	{
 		greenLevel -= theGreen;
 		ok = true;
+		markSimulationChanged();
 	}
 	greenInkLock.unlock();
 	return ok;
@@ -199,12 +415,15 @@ bool acquireGreenInk(int theGreen)
 
 bool acquireBlueInk(int theBlue)
 {
+	if (inkTanks != nullptr)
+		return acquireSharedInk(BLUE_TRAV, theBlue);
 	bool ok = false;
 	blueInkLock.lock();
 	if (blueLevel >= theBlue)
 	{
 		blueLevel -= theBlue;
 		ok = true;
+		markSimulationChanged();
 	}
 	blueInkLock.unlock();
 	return ok;
@@ -218,117 +437,619 @@ bool acquireBlueInk(int theBlue)
 //
 bool refillRedInk(int theRed)
 {
+	if (inkTanks != nullptr)
+		return refillSharedInk(RED_TRAV, theRed);
 	bool ok = false;
-	refillRedLock.lock();
+	redInkLock.lock();
 	if (redLevel + theRed <= MAX_LEVEL)
 	{
 		redLevel += theRed;
 		ok = true;
+		markSimulationChanged();
 	}
-	refillRedLock.unlock();
+	redInkLock.unlock();
 	return ok;
 }
 
 bool refillGreenInk(int theGreen)
 {
+	if (inkTanks != nullptr)
+		return refillSharedInk(GREEN_TRAV, theGreen);
 	bool ok = false;
-	refillGreenLock.lock();
+	greenInkLock.lock();
 	if (greenLevel + theGreen <= MAX_LEVEL)
 	{
 		greenLevel += theGreen;
 		ok = true;
+		markSimulationChanged();
 	}
-	refillGreenLock.unlock();
+	greenInkLock.unlock();
 	return ok;
 }
 
 bool refillBlueInk(int theBlue)
 {
+	if (inkTanks != nullptr)
+		return refillSharedInk(BLUE_TRAV, theBlue);
 	bool ok = false;
-	refillBlueLock.lock();
+	blueInkLock.lock();
 	if (blueLevel + theBlue <= MAX_LEVEL)
 	{
 		blueLevel += theBlue;
 		ok = true;
+		markSimulationChanged();
 	}
-	refillBlueLock.unlock();
+	blueInkLock.unlock();
 	return ok;
 }
 
-void faster() {
-	if (stime > 11) stime = 9 * stime / 10;
+//------------------------------------------------------------------------
+//	With --shared-ink, the tanks are in shared memory (see inkTanks.h)
+//------------------------------------------------------------------------
+//
+bool acquireSharedInk(int type, int amount)
+{
+	if (!takeInk(inkTanks, type, amount))
+		return false;
+	markSimulationChanged();
+	return true;
 }
 
-void slower() {
-	stime = 11 * stime / 10;
+bool refillSharedInk(int type, int amount)
+{
+	if (!addInk(inkTanks, type, amount, MAX_LEVEL))
+		return false;
+	markSimulationChanged();
+	return true;
+}
+
+int currentInkLevel(int type)
+{
+	if (inkTanks != nullptr)
+		return inkLevel(inkTanks, type);
+	return type == RED_TRAV ? redLevel : type == GREEN_TRAV ? greenLevel : blueLevel;
+}
+
+// take the ink of the traveler's next step, waiting for refills as long as it
+// takes.  Returns false if the traveler must stop instead
+bool takeStepInk(TravelerInfo *traveler)
+{
+	const TravelerType type = traveler->type;
+	while (!(type == RED_TRAV ? acquireRedInk(1) : type == GREEN_TRAV ? acquireGreenInk(1) : acquireBlueInk(1)))
+	{
+		if (stopSimulation || killRequested(traveler))
+			return false;
+		waitForTankRefill(type);
+	}
+	return true;
 }
+
+// what a traveler does while its tank is empty
+void waitForTankRefill(int type)
+{
+	const auto start = std::chrono::steady_clock::now();
+	if (inkTanks != nullptr)
+		waitForInk(inkTanks, type, INK_WAIT_TIMEOUT);
+	else
+		usleep(1000);
+	inkStallTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
 //------------------------------------------------------------------------
-//	You shouldn't have to touch this one.  Definitely if you don't
-//	add the "producer" threads, and probably not even if you do.
+//	These only queue the change (see drainSimulationCommands).  A full
+//	queue drops it, and returns false.
 //------------------------------------------------------------------------
-void speedupProducers(void)
+//
+bool queueSimulationCommand(int op, int arg0, int arg1)
 {
-	//	decrease sleep time by 20%, but don't get too small
-	int newSleepTime = (8 * producerSleepTime) / 10;
-	
-	if (newSleepTime > MIN_SLEEP_TIME)
+	QueuedCommand command;
+	command.op = op;
+	command.args[0] = arg0;
+	command.args[1] = arg1;
+	return pushCommand(simulationCommands, command);
+}
+
+// true once the main thread has carried out the commands queued so far (or
+// stopped for good)
+std::function<bool(void)> commandsApplied(void)
+{
+	//	the commands are carried out in queue order, and the last one is before head
+	const uint32_t queued = simulationCommands.head.load(std::memory_order_relaxed);
+	return [queued]()
 	{
-		producerSleepTime = newSleepTime;
-	}
+		return stopSimulation || (int32_t) (numAppliedCommands.load(std::memory_order_acquire) - queued) >= 0;
+	};
+}
+
+// the ink goes in as soon as its tank has room for it
+bool requestRefill(TravelerType type, int amount)
+{
+	return queueSimulationCommand(SIM_REFILL, type, amount);
+}
+
+void faster() {
+	queueSimulationCommand(SIM_FASTER);
+}
+
+void slower() {
+	queueSimulationCommand(SIM_SLOWER);
+}
+
+void speedupProducers(void)
+{
+	queueSimulationCommand(SIM_SPEEDUP_PRODUCERS);
 }
 
 void slowdownProducers(void)
 {
-	//	increase sleep time by 20%
-	producerSleepTime = (12 * producerSleepTime) / 10;
+	queueSimulationCommand(SIM_SLOWDOWN_PRODUCERS);
 }
 
-void readPipe(std::string pipe_path) 
+// carry out the queued commands.  Called by the main thread only: by the
+// timer before every frame, or every HEADLESS_POLL_TIME without a window
+void drainSimulationCommands(void)
 {
-	while (true) 
+	QueuedCommand command;
+	while (popCommand(simulationCommands, command))
 	{
-		std::ifstream pipeStream(pipe_path);
-		if (!pipeStream.is_open()) 
+		switch (command.op)
 		{
-			std::cerr << "Failed to open named pipe" << std::endl;
-			return;
+			case SIM_REFILL:
+				pendingRefills.push_back(command);
+				break;
+
+			case SIM_FASTER:
+				if (stime > 11) stime = 9 * stime / 10;
+				break;
+
+			case SIM_SLOWER:
+				stime = 11 * stime / 10;
+				break;
+
+			case SIM_SPEEDUP_PRODUCERS:
+			{
+				//	decrease sleep time by 20%, but don't get too small
+				int newSleepTime = (8 * producerSleepTime) / 10;
+				if (newSleepTime > MIN_SLEEP_TIME)
+					producerSleepTime = newSleepTime;
+				break;
+			}
+
+			case SIM_SLOWDOWN_PRODUCERS:
+				//	increase sleep time by 20%
+				producerSleepTime = (12 * producerSleepTime) / 10;
+				break;
+
+			case SIM_SET_TRAVELER_SPEED:
+				stime = command.args[0];
+				break;
+
+			case SIM_SET_PRODUCER_PERIOD:
+				producerSleepTime = command.args[0];
+				break;
+
+			default:
+				break;
 		}
+		numAppliedCommands.fetch_add(1, std::memory_order_release);
+	}
+	applyPendingRefills();
+}
 
-		std::string command;
-		std::getline(pipeStream, command);
+// add the pending refills that fit in their tank now
+void applyPendingRefills(void)
+{
+	pendingRefills.erase(std::remove_if(pendingRefills.begin(), pendingRefills.end(), [](const QueuedCommand& refill)
+		{
+			const int amount = refill.args[1];
+			return refill.args[0] == RED_TRAV ? refillRedInk(amount) : refill.args[0] == GREEN_TRAV ? refillGreenInk(amount) : refillBlueInk(amount);
+		}), pendingRefills.end());
+}
 
-		// TODO: Handle command
-		if (command == "r")
+// carry out one command from the control server.  Everything but stats and
+// end goes through the simulation command queue
+void handleCommand(std::string command, std::string& replies)
+{
+	if (!command.empty() && command.back() == '\r')
+		command.pop_back();
+
+	if (command == "r")
+	{
+		requestRefill(RED_TRAV, 3 * MAX_ADD_INK);
+	}
+	else if (command == "g")
+	{
+		requestRefill(GREEN_TRAV, 3 * MAX_ADD_INK);
+	}
+	else if (command == "b")
+	{
+		requestRefill(BLUE_TRAV, 3 * MAX_ADD_INK);
+	}
+	else if (command == "+")
+	{
+		faster();
+	}
+	else if (command == "-")
+	{
+		slower();
+	}
+	else if (command == ".")
+	{
+		speedupProducers();
+	}
+	else if (command == ",")
+	{
+		slowdownProducers();
+	}
+	else if (command == "stats")
+	{
+		replies += statsJson() + "\n";
+	}
+	else if (command == "end") 
+	{
+		endRequested = true;
+	}
+}
+
+// scripted commands reply on stdout
+void handleScriptCommand(std::string command)
+{
+	std::string replies;
+	handleCommand(command, replies);
+	std::cout << replies << std::flush;
+}
+
+// one line of JSON on how the simulation is doing.  The moves per second are
+// counted since the previous query
+std::string statsJson(void)
+{
+	const auto now = std::chrono::steady_clock::now();
+	const double interval = std::chrono::duration<double>(now - lastStatsTime).count();
+	const long moves = numMoves;
+	int numTravelers, numLive = 0;
+	{
+		std::lock_guard<InstrumentedMutex> spawnGuard(spawnLock);
+		numTravelers = travelerList.size();
+		for (const TravelerInfo& traveler : travelerList)
+			numLive += traveler.isLive ? 1 : 0;
+	}
+	const long inkLockWait = redInkLock.waitTime() + greenInkLock.waitTime() + blueInkLock.waitTime();
+	const long frames = numFrames;
+
+	std::ostringstream json;
+	json << std::fixed << std::setprecision(3)
+		 << "{\"pid\":" << getpid()
+		 << ",\"uptime\":" << std::chrono::duration<double>(now - startTime).count()
+		 << ",\"travelers\":" << numTravelers
+		 << ",\"liveTravelers\":" << numLive
+		 << ",\"moves\":" << moves
+		 << ",\"movesPerSec\":" << (interval > 0 ? (moves - lastStatsMoves) / interval : 0.0)
+		 << ",\"ink\":{\"red\":" << currentInkLevel(RED_TRAV) << ",\"green\":" << currentInkLevel(GREEN_TRAV)
+		 << ",\"blue\":" << currentInkLevel(BLUE_TRAV) << "}"
+		 << ",\"inkStallMs\":" << inkStallTime / 1000.0
+		 << ",\"lockWaitMs\":{\"grid\":" << gridLock.waitTime() / 1e6 << ",\"ink\":" << inkLockWait / 1e6 << "}"
+		 << ",\"locks\":{" << lockStatsJson() << "}"
+		 << ",\"frames\":" << frames
+		 << ",\"meanFrameMs\":" << (frames > 0 ? frameTime / 1000.0 / frames : 0.0)
+		 << ",\"maxFrameMs\":" << maxFrameTime / 1000.0
+		 << ",\"commandQueue\":{\"pushed\":" << simulationCommands.numPushed
+		 << ",\"rejected\":" << simulationCommands.numRejected
+		 << ",\"maxDepth\":" << simulationCommands.maxDepth << "}"
+		 << "}";
+	lastStatsTime = now;
+	lastStatsMoves = moves;
+	return json.str();
+}
+
+// called by the control server after every wakeup
+int controlIdle(void)
+{
+	//	scripted commands go through the same path as the piped ones
+	const int scriptTimeout = runCommandScript(commandScript, handleScriptCommand);
+	pollControlBlocks();
+	pollDomain();
+	if (endRequested)
+		cleanupAndQuit();
+	if (controlBlock == nullptr && broadcastBlock == nullptr && domainBlock == nullptr)
+		return scriptTimeout;
+	return earliestTimeout(CONTROL_BLOCK_POLL_TIMEOUT, scriptTimeout);
+}
+
+// the sooner of two timeouts in ms, -1 (no timeout) being the latest
+int earliestTimeout(int timeout1, int timeout2)
+{
+	if (timeout1 < 0 || (timeout2 >= 0 && timeout2 < timeout1))
+		return timeout2;
+	return timeout1;
+}
+
+// carry out the requests waiting in the shared-memory control block and the
+// broadcast slot, and publish our state in the control block
+void pollControlBlocks(void)
+{
+	ControlRequest request;
+	std::string replies;
+	if (controlBlock != nullptr)
+	{
+		while (popControlRequest(controlBlock, request))
 		{
-			while(!refillRedInk(3 * MAX_ADD_INK));
+			replies.clear();
+			handleMessage(reinterpret_cast<const char*>(&request), sizeof(request), replies);
+			ControlHeader ack;
+			memcpy(&ack, replies.data(), sizeof(ack));
+			blockAcks.push_back({request.header.seq, ack.status, ackCondition});
 		}
-		else if (command == "g")
+		while (!blockAcks.empty() && (!blockAcks.front().ready || blockAcks.front().ready()))
 		{
-			while(!refillGreenInk(3 * MAX_ADD_INK));
+			publishControlAck(controlBlock, blockAcks.front().seq, blockAcks.front().status);
+			blockAcks.pop_front();
 		}
-		else if (command == "b")
+
+		int numTravelers, numLive = 0;
 		{
-			while(!refillBlueInk(3 * MAX_ADD_INK));
+			std::lock_guard<InstrumentedMutex> spawnGuard(spawnLock);
+			numTravelers = travelerList.size();
+			for (const TravelerInfo& traveler : travelerList)
+				numLive += traveler.isLive ? 1 : 0;
 		}
-		else if (command == "end") 
+		controlBlock->redLevel.store(currentInkLevel(RED_TRAV), std::memory_order_relaxed);
+		controlBlock->greenLevel.store(currentInkLevel(GREEN_TRAV), std::memory_order_relaxed);
+		controlBlock->blueLevel.store(currentInkLevel(BLUE_TRAV), std::memory_order_relaxed);
+		controlBlock->numTravelers.store(numTravelers, std::memory_order_relaxed);
+		controlBlock->numLiveTravelers.store(numLive, std::memory_order_relaxed);
+		controlBlock->numMoves.store(numMoves, std::memory_order_relaxed);
+		controlBlock->heartbeat.fetch_add(1, std::memory_order_release);
+	}
+
+	const uint32_t numLost = numBroadcastsLost;
+	while (broadcastBlock != nullptr && readBroadcastRequest(broadcastBlock, numBroadcastsSeen, request, numBroadcastsLost))
+	{
+		replies.clear();
+		handleMessage(reinterpret_cast<const char*>(&request), sizeof(request), replies);
+	}
+	if (numBroadcastsLost != numLost)
+		std::cerr << "Missed " << numBroadcastsLost - numLost << " broadcast requests" << std::endl;
+}
+
+// binary requests from the socket: the control server holds the acks that
+// must wait
+void handleSocketMessage(const char* message, size_t length, std::string& replies)
+{
+	handleMessage(message, length, replies);
+	if (ackCondition)
+		holdControlAck(ackCondition);
+}
+
+// carry out one binary request and append its ack (see controlProtocol.h).
+// An ack that must wait for the operation to take effect is left with
+// ackCondition set
+void handleMessage(const char* message, size_t length, std::string& replies)
+{
+	ControlRequest request;
+	memset(&request, 0, sizeof(request));
+	memcpy(&request, message, std::min(length, sizeof(request)));
+
+	ControlAck ack;
+	ack.header.length = sizeof(ControlAck);
+	ack.header.op = request.header.op;
+	ack.header.status = CONTROL_OK;
+	ack.header.seq = request.header.seq;
+	ack.value = 0;
+	ackCondition = nullptr;
+
+	const int arg0 = request.args[0], arg1 = request.args[1];
+	switch (request.header.op)
+	{
+		//	the ack tells whether the ink went in, so refills are done right away
+		case CONTROL_REFILL:
+			if (arg1 <= 0 || arg0 < 0 || arg0 >= NUM_TRAV_TYPES)
+				ack.header.status = CONTROL_BAD_ARGUMENT;
+			else if (!(arg0 == RED_TRAV ? refillRedInk(arg1) : arg0 == GREEN_TRAV ? refillGreenInk(arg1) : refillBlueInk(arg1)))
+				ack.header.status = CONTROL_TANK_FULL;
+			break;
+
+		//	the ack waits for the main thread to make the change
+		case CONTROL_SET_TRAVELER_SPEED:
+			if (arg0 <= 0)
+				ack.header.status = CONTROL_BAD_ARGUMENT;
+			else if (!queueSimulationCommand(SIM_SET_TRAVELER_SPEED, arg0))
+				ack.header.status = CONTROL_REFUSED;
+			else
+				ackCondition = commandsApplied();
+			break;
+
+		case CONTROL_SET_PRODUCER_PERIOD:
+			if (arg0 < MIN_SLEEP_TIME)
+				ack.header.status = CONTROL_BAD_ARGUMENT;
+			else if (!queueSimulationCommand(SIM_SET_PRODUCER_PERIOD, arg0))
+				ack.header.status = CONTROL_REFUSED;
+			else
+				ackCondition = commandsApplied();
+			break;
+
+		case CONTROL_SPAWN_TRAVELER:
+			if (arg0 < -1 || arg0 >= NUM_TRAV_TYPES)
+				ack.header.status = CONTROL_BAD_ARGUMENT;
+			else if ((ack.value = spawnTraveler(arg0)) < 0)
+				ack.header.status = CONTROL_REFUSED;
+			break;
+
+		//	the ack waits for the traveler's thread to stop
+		case CONTROL_KILL_TRAVELER:
 		{
-			exit(0);
+			std::lock_guard<InstrumentedMutex> spawnGuard(spawnLock);
+			if (arg0 < 0 || arg0 >= (int) travelerList.size())
+				ack.header.status = CONTROL_BAD_ARGUMENT;
+			else
+			{
+				//	a traveler that already stopped needs nothing more
+				int state = TRAVELER_RUNNING;
+				if (travelerStates[arg0].compare_exchange_strong(state, TRAVELER_KILL_REQUESTED) || state == TRAVELER_KILL_REQUESTED)
+				{
+					const int index = arg0;
+					ackCondition = [index]() { return stopSimulation || travelerStates[index] != TRAVELER_KILL_REQUESTED; };
+				}
+			}
+			break;
 		}
-    }
-    // pipeStream.close();
+
+		case CONTROL_QUERY_STATS:
+		{
+			ControlStatsAck statsAck;
+			memset(&statsAck, 0, sizeof(statsAck));
+			statsAck.header = ack.header;
+			statsAck.header.length = sizeof(ControlStatsAck);
+			statsAck.stats.numMoves = numMoves;
+			{
+				std::lock_guard<InstrumentedMutex> spawnGuard(spawnLock);
+				statsAck.stats.numTravelers = travelerList.size();
+				for (const TravelerInfo& traveler : travelerList)
+					statsAck.stats.numLiveTravelers += traveler.isLive ? 1 : 0;
+			}
+			statsAck.stats.redLevel = currentInkLevel(RED_TRAV);
+			statsAck.stats.greenLevel = currentInkLevel(GREEN_TRAV);
+			statsAck.stats.blueLevel = currentInkLevel(BLUE_TRAV);
+			statsAck.stats.travelerSleepTime = stime;
+			statsAck.stats.producerSleepTime = producerSleepTime;
+			replies.append(reinterpret_cast<const char*>(&statsAck), sizeof(statsAck));
+			return;
+		}
+
+		case CONTROL_END:
+			endRequested = true;
+			break;
+
+		default:
+			ack.header.status = CONTROL_UNKNOWN_OP;
+			break;
+	}
+	replies.append(reinterpret_cast<const char*>(&ack), sizeof(ack));
+}
+
+// add one traveler of the given type (-1 for a random one) at a free location,
+// and start its thread.  Returns its index in travelerList, or -1 if the
+// simulation is stopping or there is no room left for another traveler
+int spawnTraveler(int type)
+{
+	std::lock_guard<InstrumentedMutex> spawnGuard(spawnLock);
+	if (stopSimulation || travelerList.size() == travelerList.capacity())
+		return -1;
+
+	TravelerInfo traveler;
+	uniform_int_distribution<int> ttypes(0, NUM_TRAV_TYPES - 1);
+	traveler.type = (TravelerType) (type < 0 ? ttypes(myEngine) : type);
+	uniform_int_distribution<int> dirDist(0, NUM_TRAVEL_DIRECTIONS-1);
+	traveler.dir = static_cast<TravelDirection>(dirDist(myEngine));
+	traveler.isLive = true;
+
+	//	the travelers move under the grid lock
+	gridLock.lock();
+	do 
+	{
+		uniform_int_distribution<int> rowDist(CORNER_DISTANCE, num_rows-CORNER_DISTANCE);
+		traveler.row = rowDist(myEngine);
+		uniform_int_distribution<int> colDist(CORNER_DISTANCE, num_cols-CORNER_DISTANCE);
+		traveler.col = colDist(myEngine);
+	} 
+	while (std::find_if(travelerList.begin(), travelerList.end(), [&](const TravelerInfo& other) { return other.isLive && other.row == traveler.row && other.col == traveler.col; }) != travelerList.end());
+	travelerList.push_back(traveler);
+	gridLock.unlock();
+
+	const int index = travelerList.size() - 1;
+	travelerThreads.push_back(std::thread(travelerThreadFunc, &travelerList[index]));
+	numLiveThreads ++;
+	markSimulationChanged();
+	return index;
+}
+
+int main(int argc, char** argv)
+{
+	//	A zygote only gets to runTravel in the children it forks
+	if (argc == 3 && std::string(argv[1]) == "--zygote")
+		return runZygote(argv[2], runTravel);
+	return runTravel(argc, argv);
 }
 
 //------------------------------------------------------------------------
 //	You shouldn't have to change anything in the main function
 //------------------------------------------------------------------------
-int main(int argc, char** argv)
+int runTravel(int argc, char** argv)
 {
-    // Verify that three arguments were passed
-    if (argc != 5) 
+	//	a zygote's children all start with the engine state of their parent
+	myEngine.seed(myRandDev());
+	initializeCommandQueue(simulationCommands);
+
+    // Verify that the positional arguments were passed, then parse the options
+    const std::string usage = std::string("Usage: ") + argv[0] + " <num_cols> <num_rows> <num_threads> <pipe_name>"
+		" [--max-fps <n>]"
+		" [--headless [--duration <s>] [--steps <n>]]"
+		" [--frames <dir> [--frame-period <ms>] [--frame-format ppm|raw|stream] [--frame-queue <n>]]"
+		" [--control-fifo <path>]... [--control-socket <path>]"
+		" [--control-binary-socket <path>] [--control-stdin]"
+		" [--control-shm <name>] [--control-broadcast <name>]"
+		" [--domain <name> --partition <k>/<n>] [--shared-ink <name>]"
+		" [--publish <name>] [--script <file>] [--seed <n>] [--reply-fifo <path>]\n"
+		"   or: " + argv[0] + " --zygote <socket>\n";
+    if (argc < 5) 
 	{
-        std::cerr << "Usage: " << argv[0] << " <num_cols> <num_rows> <num_threads> <pipe_name>\n";
+        std::cerr << usage;
         return 1;
     }
+	for (int k = 5; k < argc; k++)
+	{
+		const std::string option = argv[k];
+		if (option == "--headless")
+			headless = true;
+		else if (option == "--max-fps" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			MAX_FPS = std::atoi(argv[++k]);
+		else if (option == "--duration" && k + 1 < argc)
+			runDuration = std::atof(argv[++k]);
+		else if (option == "--steps" && k + 1 < argc)
+			maxSteps = std::atol(argv[++k]);
+		else if (option == "--frames" && k + 1 < argc)
+			frameDir = argv[++k];
+		else if (option == "--frame-period" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			framePeriod = std::atoi(argv[++k]);
+		else if (option == "--frame-queue" && k + 1 < argc && std::atoi(argv[k + 1]) > 0)
+			frameQueueSize = std::atoi(argv[++k]);
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "ppm")
+			frameFormat = CAPTURE_PPM, k++;
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "raw")
+			frameFormat = CAPTURE_RAW, k++;
+		else if (option == "--frame-format" && k + 1 < argc && std::string(argv[k + 1]) == "stream")
+			frameFormat = CAPTURE_STREAM, k++;
+		else if (option == "--control-fifo" && k + 1 < argc)
+			controlFifos.push_back(argv[++k]);
+		else if (option == "--control-socket" && k + 1 < argc)
+			controlSocket = argv[++k];
+		else if (option == "--control-binary-socket" && k + 1 < argc)
+			controlBinarySocket = argv[++k];
+		else if (option == "--control-shm" && k + 1 < argc)
+			controlShmName = argv[++k];
+		else if (option == "--control-broadcast" && k + 1 < argc)
+			broadcastShmName = argv[++k];
+		else if (option == "--control-stdin")
+			controlStdin = true;
+		else if (option == "--reply-fifo" && k + 1 < argc)
+			replyFifo = argv[++k];
+		else if (option == "--script" && k + 1 < argc)
+			scriptPath = argv[++k];
+		else if (option == "--seed" && k + 1 < argc)
+			seed = std::strtoul(argv[++k], nullptr, 10), fixedSeed = true;
+		else if (option == "--publish" && k + 1 < argc)
+			publishName = argv[++k];
+		else if (option == "--shared-ink" && k + 1 < argc)
+			inkShmName = argv[++k];
+		else if (option == "--domain" && k + 1 < argc)
+			domainShmName = argv[++k];
+		else if (option == "--partition" && k + 1 < argc && std::sscanf(argv[k + 1], "%d/%d", &domainPartition, &numPartitions) == 2)
+			k++;
+		else
+		{
+			std::cerr << usage;
+			return 1;
+		}
+	}
 
     // Parse arguments and check for validity
     num_cols = std::atoi(argv[1]);
@@ -342,13 +1063,77 @@ int main(int argc, char** argv)
         return 1;
     }
 
-	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+	if (fixedSeed)
+		myEngine.seed(seed);
+	if (!scriptPath.empty() && !loadCommandScript(scriptPath, commandScript))
+		return 1;
+
+	//	Only keep our strip of the grid
+	globalRows = num_rows;
+	if (numPartitions < 1 || numPartitions > MAX_DOMAIN_PARTITIONS || domainPartition < 0 || domainPartition >= numPartitions
+		|| (numPartitions > 1 && domainShmName.empty()) || 2 * numPartitions > globalRows)
+	{
+		std::cerr << "Invalid partition " << domainPartition << "/" << numPartitions << ": need --domain, and two rows per strip.\n";
+		return 1;
+	}
+	partitionRows(globalRows, numPartitions, domainPartition, rowOffset, num_rows);
+	if (!domainShmName.empty() && (domainBlock = mapDomainBlock(domainShmName.c_str())) == nullptr)
+	{
+		std::cerr << "Failed to open domain block " << domainShmName << std::endl;
+		return 1;
+	}
+	const int initialLevels[NUM_INK_TANKS] = {redLevel, greenLevel, blueLevel};
+	if (!inkShmName.empty() && (inkTanks = mapInkTanks(inkShmName.c_str(), initialLevels)) == nullptr)
+	{
+		std::cerr << "Failed to open ink tanks " << inkShmName << std::endl;
+		return 1;
+	}
+	if (!publishName.empty() && (sharedGrid = createSharedGrid(publishName.c_str(), num_rows, num_cols, rowOffset, globalRows,
+																num_threads + MAX_SPAWNED_TRAVELERS, MAX_LEVEL)) == nullptr)
+	{
+		std::cerr << "Failed to create shared grid " << publishName << std::endl;
+		return 1;
+	}
+
+	startTime = lastStatsTime = std::chrono::steady_clock::now();
+	if (!headless)
+	{
+		initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+		setTimerFunc(drainSimulationCommands);
+	}
 
 	//	Now we can do application-level
 	initializeApplication();
 
-    std::thread readerThread(readPipe, pipePath);
-    // readerThread.join();
+	//	One thread takes the commands from all the sources
+	if (!initializeControlServer(handleCommand, handleSocketMessage, controlIdle))
+		std::cerr << "Failed to start the control server" << std::endl;
+	if (!addControlFifo(pipePath))
+		std::cerr << "Failed to open named pipe" << std::endl;
+	for (const std::string& path : controlFifos)
+		if (!addControlFifo(path))
+			std::cerr << "Failed to open control FIFO " << path << std::endl;
+	if (!controlSocket.empty() && !addControlSocket(controlSocket))
+		std::cerr << "Failed to open control socket " << controlSocket << std::endl;
+	if (!controlBinarySocket.empty() && !addControlBinarySocket(controlBinarySocket))
+		std::cerr << "Failed to open control socket " << controlBinarySocket << std::endl;
+	if (controlStdin && !addControlStdin())
+		std::cerr << "Failed to read commands from stdin" << std::endl;
+	if (!replyFifo.empty())
+		setControlReplyFifo(replyFifo);
+	if (!controlShmName.empty() && (controlBlock = mapControlBlock(controlShmName.c_str(), true)) == nullptr)
+		std::cerr << "Failed to create control block " << controlShmName << std::endl;
+	if (!broadcastShmName.empty() && (broadcastBlock = mapBroadcastBlock(broadcastShmName.c_str())) == nullptr)
+		std::cerr << "Failed to open broadcast block " << broadcastShmName << std::endl;
+	if (broadcastBlock != nullptr)
+		numBroadcastsSeen = broadcastBlock->count.load();
+	startCommandScript(commandScript);
+    std::thread controlThread(runControlServer);
+
+	//	Without a window, the main thread just watches the simulation
+	//	until it's time to stop
+	if (headless)
+		runHeadless();
 
 	//	Now we enter the main loop of the program and to a large extend
 	//	"lose control" over its execution.  The callback functions that 
@@ -376,15 +1161,50 @@ void cleanupAndQuit()
 	//	You would want to join all the threads before you free the grid and other
 	//	allocated data structures.  You may run into seg-fault and other ugly termination
 	//	issues otherwise.
-	//  for (auto& t : threads) {
-	//  	t.join();
-	// }
-
-	//	just nicer.  Also, if you crash there, you know something is wrong
-	//	in your code.
-	for (int i=0; i< num_rows; i++)
-		delete []grid[i];
-	delete []grid;
+	//	The main thread (end of a headless run, keyboard) and the control thread
+	//	(end request) can both get here: only the first one cleans up, and the
+	//	other one waits for it to exit the process.
+	if (stopSimulation.exchange(true))
+	{
+		while (true)
+			pause();
+	}
+	stopControlServer();
+	//	wait out a traveler being spawned
+	spawnLock.lock();
+	spawnLock.unlock();
+	for (auto& t : travelerThreads)
+		t.join();
+	for (int k = 0; k < (int) producerRedThreads.size(); k++)
+	{
+		producerRedThreads[k].join();
+		producerGreenThreads[k].join();
+		producerBlueThreads[k].join();
+	}
+	if (publishThread.joinable())
+	{
+		publishThread.join();
+		closeSharedGrid(sharedGrid, publishName.c_str(), true);
+	}
+	if (captureThread.joinable())
+	{
+		captureThread.join();
+		stopFrameCapture();
+		std::cout << "frames captured: " << capturedFrameCount()
+				  << ", dropped: " << droppedFrameCount() << std::endl;
+	}
+
+	if (controlBlock != nullptr)
+		unmapControlBlock(controlBlock, controlShmName.c_str(), true);
+	//	the traveler threads are done with it
+	if (domainBlock != nullptr)
+		unmapDomainBlock(domainBlock, domainShmName.c_str(), domainPartition == 0);
+	if (inkTanks != nullptr)
+		unmapInkTanks(inkTanks);
+	std::cout << lockStatsTable();
+
+	//	The grid and what goes with it are left for exit() to reclaim: when we
+	//	get here from another thread, the GLUT thread may still be drawing them.
 	exit(0);
 	//	clear the traveler list
 	travelerList.clear();
@@ -418,12 +1238,16 @@ void initializeApplication(void)
 		}	
 	}
 
+	initializeGridRendering(grid, num_rows, num_cols);
+
 	//---------------------------------------------------------------
 	//	You're going to have to properly initialize your travelers at random locations
 	//	on the grid:
 	//		- not ata  corner
 	//		- not at the same location as an existing traveler
 	//---------------------------------------------------------------
+	travelerList.reserve(num_threads + MAX_SPAWNED_TRAVELERS);
+	travelerStates = new std::atomic<int>[travelerList.capacity()]();
 	makeTravelers();
 
     for (int k = 0; k < num_threads; k++)
@@ -438,12 +1262,17 @@ void initializeApplication(void)
 		producerGreenThreads.push_back(std::thread(producerGreenThreadFunc));
 		producerBlueThreads.push_back(std::thread(producerBlueThreadFunc));
     }
+
+	if (!frameDir.empty() && startFrameCapture(frameDir, frameFormat, num_rows, num_cols, frameQueueSize))
+		captureThread = std::thread(captureThreadFunc);
+	if (sharedGrid != nullptr)
+		publishThread = std::thread(publishThreadFunc);
 }
 
 // add red ink to its tank
 void producerRedThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillRedInk(MAX_ADD_INK);
@@ -453,7 +1282,7 @@ void producerRedThreadFunc()
 // add green ink to its tank
 void producerGreenThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillGreenInk(MAX_ADD_INK);
@@ -463,21 +1292,103 @@ void producerGreenThreadFunc()
 // add blue ink to its tank
 void producerBlueThreadFunc()
 {
-	while (true)
+	while (!stopSimulation)
 	{
 		usleep(producerSleepTime);
 		refillBlueInk(MAX_ADD_INK);
 	}
 }
 
+// main thread loop when running without a window
+void runHeadless(void)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	while (true)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		const double elapsed = std::chrono::duration<double>(now - start).count();
+
+		bool anyLive = false;
+		for (const TravelerInfo& traveler : travelerList)
+			anyLive = anyLive || traveler.isLive;
+
+		//	in a domain, travelers may come back from our neighbors
+		if ((!anyLive && domainBlock == nullptr) || (runDuration > 0 && elapsed >= runDuration) || (maxSteps > 0 && numMoves >= maxSteps))
+		{
+			std::cout << "elapsed: " << elapsed << " s, moves: " << numMoves << std::endl;
+			break;
+		}
+		drainSimulationCommands();
+		usleep(HEADLESS_POLL_TIME);
+	}
+	cleanupAndQuit();
+}
+
+// hand a snapshot of the grid to the encoder every framePeriod ms.  The copy
+// is all that happens here; a frame is dropped if the encoder is behind
+void captureThreadFunc()
+{
+	auto nextFrame = std::chrono::steady_clock::now();
+	while (!stopSimulation)
+	{
+		if (std::chrono::steady_clock::now() >= nextFrame)
+		{
+			gridLock.lock();
+			captureFrame(grid);
+			gridLock.unlock();
+			nextFrame += std::chrono::milliseconds(framePeriod);
+		}
+		usleep(HEADLESS_POLL_TIME);
+	}
+}
+
+// copy the grid, the travelers and the ink levels into the shared snapshot
+// every PUBLISH_PERIOD ms
+void publishThreadFunc()
+{
+	int32_t* cells = sharedGridCells(sharedGrid);
+	SharedTraveler* travelers = sharedGridTravelers(sharedGrid);
+	while (!stopSimulation)
+	{
+		gridLock.lock();
+		beginSharedGridUpdate(sharedGrid);
+		for (int i = 0; i < num_rows; i++)
+			memcpy(cells + i * num_cols, grid[i], sizeof(int32_t) * num_cols);
+
+		const int numTravelers = std::min((int) travelerList.size(), (int) sharedGrid->maxTravelers);
+		int numLive = 0;
+		for (int k = 0; k < numTravelers; k++)
+		{
+			travelers[k].type = travelerList[k].type;
+			travelers[k].row = travelerList[k].row;
+			travelers[k].col = travelerList[k].col;
+			travelers[k].dir = travelerList[k].dir;
+			travelers[k].isLive = travelerList[k].isLive;
+			numLive += travelerList[k].isLive ? 1 : 0;
+		}
+		sharedGrid->state.numTravelers = numTravelers;
+		sharedGrid->state.numLiveTravelers = numLive;
+		sharedGrid->state.redLevel = currentInkLevel(RED_TRAV);
+		sharedGrid->state.greenLevel = currentInkLevel(GREEN_TRAV);
+		sharedGrid->state.blueLevel = currentInkLevel(BLUE_TRAV);
+		sharedGrid->state.numMoves = numMoves;
+		endSharedGridUpdate(sharedGrid);
+		gridLock.unlock();
+
+		usleep(PUBLISH_PERIOD * 1000);
+	}
+}
+
 // function executed by each traveler thread
 void travelerThreadFunc(TravelerInfo *traveler) 
 {
 	
-	while (traveler->isLive)
+	while (traveler->isLive && !stopSimulation)
 	{
-		// random perpendicular direction
+		// random perpendicular direction, not off the edge of the whole grid
 		int currDir  = static_cast<int>(traveler->dir);
+		const int globalRow = traveler->row + rowOffset;
 		TravelDirection newDir;
 
 		std::uniform_int_distribution<int> dirss(0, NUM_TRAVEL_DIRECTIONS - 1);
@@ -485,39 +1396,171 @@ void travelerThreadFunc(TravelerInfo *traveler)
 		{
 			newDir = static_cast<TravelDirection>(dirss(myEngine));
 		}
-		while (newDir == currDir || abs(newDir - currDir) == 2 || (newDir == NORTH && traveler->row == 0) || (newDir == SOUTH && traveler->row == num_rows - 1) || ((newDir == WEST && traveler->col == 0)) || ((newDir == EAST && traveler->col == num_cols - 1)) );
+		while (newDir == currDir || abs(newDir - currDir) == 2 || (newDir == NORTH && globalRow == 0) || (newDir == SOUTH && globalRow == globalRows - 1) || ((newDir == WEST && traveler->col == 0)) || ((newDir == EAST && traveler->col == num_cols - 1)) );
 
 		auto myTuple = getTargetCordinate(traveler, newDir, traveler->row, traveler->col);
 		int newRow = std::get<0>(myTuple);
 		int newCol = std::get<1>(myTuple);
-		
-		while (traveler->row != newRow) 
-		{
-			traveler->dir = newDir;
-			if (traveler->row < newRow)
-				colorTrailUp(traveler);
 
-			else if (traveler->row > newRow)
-				colorTrailDown(traveler);
+		if (!moveTraveler(traveler, newDir, newRow, newCol))
+			break;
+	}
+	travelerStates[traveler - travelerList.data()] = TRAVELER_STOPPED;
+}
 
-			usleep(stime);
-		}
+// thread of a traveler handed over by a neighbor: it first finishes the move
+// it was making there
+void arrivingTravelerThreadFunc(TravelerInfo *traveler, int targetRow, int targetCol)
+{
+	if (moveTraveler(traveler, traveler->dir, targetRow, targetCol))
+		travelerThreadFunc(traveler);
+	else
+		travelerStates[traveler - travelerList.data()] = TRAVELER_STOPPED;
+}
 
-		while (traveler->col != newCol)
+// move the traveler to (newRow, newCol), vertically first.  Returns false if
+// it went out of our strip of the domain on the way
+bool moveTraveler(TravelerInfo *traveler, TravelDirection newDir, int newRow, int newCol)
+{
+	while (traveler->row != newRow && !stopSimulation && !killRequested(traveler)) 
+	{
+		traveler->dir = newDir;
+		const int nextRow = traveler->row < newRow ? traveler->row + 1 : traveler->row - 1;
+		if (nextRow < 0 || nextRow >= num_rows)
 		{
-			traveler->dir = newDir;
-			if (traveler->col < newCol)
-				colorTrailLeft(traveler);
+			handOffTraveler(traveler, newRow, newCol);
+			numMoves++;
+			return false;
+		}
+		if (traveler->row < newRow)
+			colorTrailUp(traveler);
 
-			else if (traveler->col > newCol)
-				colorTrailRight(traveler);
+		else if (traveler->row > newRow)
+			colorTrailDown(traveler);
 
-			usleep(stime);
-		}
-		
-		if ((traveler->row == 0 && traveler->col == 0) || (traveler->row == 0 && traveler->col == num_cols - 1) || (traveler->row == num_rows - 1 && traveler->col == 0) || (traveler->row == num_rows - 1 && traveler->col == num_cols - 1))
-			traveler->isLive = false; 
+		numMoves++;
+		usleep(stime);
+	}
+
+	while (traveler->col != newCol && !stopSimulation && !killRequested(traveler))
+	{
+		traveler->dir = newDir;
+		if (traveler->col < newCol)
+			colorTrailLeft(traveler);
+
+		else if (traveler->col > newCol)
+			colorTrailRight(traveler);
+
+		numMoves++;
+		usleep(stime);
+	}
+	
+	const int globalRow = traveler->row + rowOffset;
+	if (killRequested(traveler) || (globalRow == 0 && traveler->col == 0) || (globalRow == 0 && traveler->col == num_cols - 1) || (globalRow == globalRows - 1 && traveler->col == 0) || (globalRow == globalRows - 1 && traveler->col == num_cols - 1))
+	{
+		traveler->isLive = false;
+		markSimulationChanged();
+	}
+	return true;
+}
+
+bool killRequested(const TravelerInfo *traveler)
+{
+	return travelerStates[traveler - travelerList.data()] == TRAVELER_KILL_REQUESTED;
+}
+
+// the traveler steps out of our strip: it leaves its trail on the last cell,
+// then goes on in the neighboring process, and its slot here is free
+void handOffTraveler(TravelerInfo *traveler, int newRow, int newCol)
+{
+	//	killed while waiting for ink: it goes no further
+	if (!colorTrailOut(traveler))
+	{
+		gridLock.lock();
+		traveler->isLive = false;
+		gridLock.unlock();
+		markSimulationChanged();
+		return;
+	}
+
+	const bool down = newRow > traveler->row;
+	TravelerHandoff handoff;
+	handoff.type = traveler->type;
+	handoff.dir = traveler->dir;
+	handoff.row = traveler->row + rowOffset + (down ? 1 : -1);
+	handoff.col = traveler->col;
+	handoff.targetRow = newRow + rowOffset;
+	handoff.targetCol = newCol;
+	HandoffRing& ring = down ? domainBlock->toNext[domainPartition] : domainBlock->toPrevious[domainPartition];
+	{
+		std::lock_guard<InstrumentedMutex> handoffGuard(handoffLock);
+		while (!pushHandoff(ring, handoff) && !stopSimulation)
+			usleep(1000);
 	}
+
+	gridLock.lock();
+	traveler->isLive = false;
+	gridLock.unlock();
+	markSimulationChanged();
+
+	std::lock_guard<InstrumentedMutex> spawnGuard(spawnLock);
+	freeTravelerSlots.push_back(traveler - travelerList.data());
+}
+
+// a traveler crossed into our strip: give it a slot in travelerList (the one of
+// a traveler that left, if any) and a thread
+void receiveTraveler(const TravelerHandoff& handoff)
+{
+	std::lock_guard<InstrumentedMutex> spawnGuard(spawnLock);
+	if (stopSimulation)
+		return;
+
+	TravelerInfo traveler;
+	traveler.type = static_cast<TravelerType>(handoff.type);
+	traveler.dir = static_cast<TravelDirection>(handoff.dir);
+	traveler.row = handoff.row - rowOffset;
+	traveler.col = handoff.col;
+	traveler.isLive = true;
+
+	int index;
+	if (!freeTravelerSlots.empty())
+	{
+		index = freeTravelerSlots.back();
+		freeTravelerSlots.pop_back();
+		travelerThreads[index].join();
+		travelerStates[index] = TRAVELER_RUNNING;
+		gridLock.lock();
+		travelerList[index] = traveler;
+		gridLock.unlock();
+		travelerThreads[index] = std::thread(arrivingTravelerThreadFunc, &travelerList[index], handoff.targetRow - rowOffset, handoff.targetCol);
+	}
+	else if (travelerList.size() < travelerList.capacity())
+	{
+		gridLock.lock();
+		travelerList.push_back(traveler);
+		gridLock.unlock();
+		index = travelerList.size() - 1;
+		travelerThreads.push_back(std::thread(arrivingTravelerThreadFunc, &travelerList[index], handoff.targetRow - rowOffset, handoff.targetCol));
+	}
+	else
+	{
+		std::cerr << "No room for a traveler coming from a neighbor" << std::endl;
+		return;
+	}
+	numLiveThreads ++;
+	markSimulationChanged();
+}
+
+// take in the travelers that our neighbors handed over
+void pollDomain(void)
+{
+	if (domainBlock == nullptr)
+		return;
+	TravelerHandoff handoff;
+	while (domainPartition > 0 && popHandoff(domainBlock->toNext[domainPartition - 1], handoff))
+		receiveTraveler(handoff);
+	while (domainPartition < numPartitions - 1 && popHandoff(domainBlock->toPrevious[domainPartition + 1], handoff))
+		receiveTraveler(handoff);
 }
 
 // make travelers and push them into our list of travelers
@@ -553,9 +1596,9 @@ std::tuple<int, int> getTargetCordinate(TravelerInfo* traveler, TravelDirection
 	int lengthr, lengthc;
 	
 	// random displacement length
-	std::uniform_int_distribution<int> lengthDistn(1, traveler->row);
+	std::uniform_int_distribution<int> lengthDistn(1, traveler->row + rowOffset);
 	std::uniform_int_distribution<int> lengthDistw(1, traveler->col);
-	std::uniform_int_distribution<int> lengthDists(1, (num_rows - traveler->row - 1));
+	std::uniform_int_distribution<int> lengthDists(1, (globalRows - traveler->row - rowOffset - 1));
 	std::uniform_int_distribution<int> lengthDiste(1, (num_cols - traveler->col - 1));
 
 	switch (newDir)
@@ -589,7 +1632,7 @@ void colorTrailRight(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->col--;
 
@@ -597,11 +1640,12 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 			
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | new_color;
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->col--;
 
@@ -609,11 +1653,12 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | (new_color << 8);
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->col--;
 
@@ -621,6 +1666,7 @@ void colorTrailRight(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row][traveler->col + 1] = grid[traveler->row][traveler->col + 1] | (new_color << 16);
+		markGridCellDirty(traveler->row, traveler->col + 1);
 
 		gridLock.unlock();
 		break;
@@ -636,7 +1682,7 @@ void colorTrailLeft(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->col++;
 
@@ -644,11 +1690,12 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | new_color;
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->col++;
 
@@ -656,11 +1703,12 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | (new_color << 8);
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->col++;
 
@@ -668,6 +1716,7 @@ void colorTrailLeft(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row][traveler->col - 1] = grid[traveler->row][traveler->col - 1] | (new_color << 16);
+		markGridCellDirty(traveler->row, traveler->col - 1);
 
 		gridLock.unlock();
 		break;
@@ -676,6 +1725,23 @@ void colorTrailLeft(TravelerInfo *traveler)
 	}
 }
 
+// leave the traveler's color on the cell it is on.  Returns false if the
+// traveler was killed while waiting for ink
+bool colorTrailOut(TravelerInfo *traveler)
+{
+	const int shift = 8 * traveler->type;
+	if (!takeStepInk(traveler))
+		return !killRequested(traveler);
+	gridLock.lock();
+	int new_color = (grid[traveler->row][traveler->col] >> shift & 0xFF) + colorIncrement;
+	if (new_color > 255) new_color = 255;
+
+	grid[traveler->row][traveler->col] = grid[traveler->row][traveler->col] | (new_color << shift);
+	markGridCellDirty(traveler->row, traveler->col);
+	gridLock.unlock();
+	return true;
+}
+
 // updates the traveler down and leave a color trail up
 void colorTrailUp(TravelerInfo *traveler) 
 {
@@ -683,7 +1749,7 @@ void colorTrailUp(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->row++;
 
@@ -691,11 +1757,12 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 		
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | new_color;
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->row++;
 
@@ -703,11 +1770,12 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | (new_color << 8);
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->row++;
 
@@ -715,6 +1783,7 @@ void colorTrailUp(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row - 1][traveler->col] = grid[traveler->row - 1][traveler->col] | (new_color << 16);
+		markGridCellDirty(traveler->row - 1, traveler->col);
 
 		gridLock.unlock();
 		break;
@@ -730,7 +1799,7 @@ void colorTrailDown(TravelerInfo *traveler)
 	switch (traveler->type)
 	{
 	case RED_TRAV:
-		while (!acquireRedInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->row--;
 
@@ -738,11 +1807,12 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 		
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | new_color;
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case GREEN_TRAV:
-		while (!acquireGreenInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->row--;
 
@@ -750,11 +1820,12 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | (new_color << 8);
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		gridLock.unlock();
 		break;
 	case BLUE_TRAV:
-		while (!acquireBlueInk(1)) usleep(1000);
+		if (!takeStepInk(traveler)) break;
 		gridLock.lock();
 		traveler->row--;
 
@@ -762,6 +1833,7 @@ void colorTrailDown(TravelerInfo *traveler)
 		if (new_color > 255) new_color = 255;
 	
 		grid[traveler->row + 1][traveler->col] = grid[traveler->row + 1][traveler->col] | (new_color << 16);
+		markGridCellDirty(traveler->row + 1, traveler->col);
 
 		gridLock.unlock();
 		break;
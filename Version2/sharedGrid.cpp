@@ -0,0 +1,119 @@
+//
+//  sharedGrid.cpp
+//
+
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+//
+#include "sharedGrid.h"
+
+using namespace std;
+
+size_t sharedGridSize(int numRows, int numCols, int maxTravelers)
+{
+	return sizeof(SharedGridHeader) + sizeof(int32_t) * numRows * numCols + sizeof(SharedTraveler) * maxTravelers;
+}
+
+//	The process starts its segment over, whatever size an older one had
+SharedGridHeader* createSharedGrid(const char* name, int numRows, int numCols, int rowOffset, int globalRows,
+								   int maxTravelers, int maxLevel)
+{
+	const size_t size = sharedGridSize(numRows, numCols, maxTravelers);
+	const int fd = shm_open(name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0)
+		return nullptr;
+	if (ftruncate(fd, size) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	void* segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED)
+		return nullptr;
+
+	SharedGridHeader* header = new (segment) SharedGridHeader;
+	header->numRows = numRows;
+	header->numCols = numCols;
+	header->rowOffset = rowOffset;
+	header->globalRows = globalRows;
+	header->maxTravelers = maxTravelers;
+	header->maxLevel = maxLevel;
+	header->magic.store(SHARED_GRID_MAGIC, memory_order_release);
+	return header;
+}
+
+//	Read-only, and only once the process has set it up
+SharedGridHeader* openSharedGrid(const char* name)
+{
+	const int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return nullptr;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(SharedGridHeader))
+	{
+		close(fd);
+		return nullptr;
+	}
+	void* segment = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED)
+		return nullptr;
+
+	SharedGridHeader* header = static_cast<SharedGridHeader*>(segment);
+	if (header->magic.load(memory_order_acquire) != SHARED_GRID_MAGIC
+		|| (size_t) info.st_size != sharedGridSize(header->numRows, header->numCols, header->maxTravelers))
+	{
+		munmap(segment, info.st_size);
+		return nullptr;
+	}
+	return header;
+}
+
+void closeSharedGrid(SharedGridHeader* header, const char* name, bool unlinkName)
+{
+	munmap(header, sharedGridSize(header->numRows, header->numCols, header->maxTravelers));
+	if (unlinkName)
+		shm_unlink(name);
+}
+
+int32_t* sharedGridCells(const SharedGridHeader* header)
+{
+	return reinterpret_cast<int32_t*>(const_cast<SharedGridHeader*>(header) + 1);
+}
+
+SharedTraveler* sharedGridTravelers(const SharedGridHeader* header)
+{
+	return reinterpret_cast<SharedTraveler*>(sharedGridCells(header) + header->numRows * header->numCols);
+}
+
+void beginSharedGridUpdate(SharedGridHeader* header)
+{
+	header->seq.store(header->seq.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+void endSharedGridUpdate(SharedGridHeader* header)
+{
+	header->seq.store(header->seq.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+bool readSharedGrid(const SharedGridHeader* header, SharedGridState& state, int32_t* cells, SharedTraveler* travelers)
+{
+	const uint32_t seq = header->seq.load(memory_order_acquire);
+	if ((seq & 1) != 0)
+		return false;
+
+	state = header->state;
+	memcpy(cells, sharedGridCells(header), sizeof(int32_t) * header->numRows * header->numCols);
+	if (state.numTravelers < 0 || state.numTravelers > header->maxTravelers)
+		return false;
+	memcpy(travelers, sharedGridTravelers(header), sizeof(SharedTraveler) * state.numTravelers);
+
+	atomic_thread_fence(memory_order_acquire);
+	return header->seq.load(memory_order_relaxed) == seq;
+}
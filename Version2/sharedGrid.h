@@ -0,0 +1,70 @@
+//
+//  sharedGrid.h
+//
+
+#ifndef SHARED_GRID_H
+#define SHARED_GRID_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//-----------------------------------------------------------------------------
+//	A snapshot of a simulation in shared memory, for travel-viewer.
+//
+//	With --publish <name>, a travel process creates a POSIX shared memory
+//	segment holding a SharedGridHeader, followed by its grid (numRows rows of
+//	numCols cells) and room for maxTravelers SharedTravelers, and copies its
+//	state there every PUBLISH_PERIOD ms.  Readers map the segment read-only.
+//	The copy is guarded by a sequence lock: seq is odd while the process
+//	writes, and a reader keeps what it copied only if seq was the same even
+//	number before and after.
+//-----------------------------------------------------------------------------
+
+const uint32_t SHARED_GRID_MAGIC = 0x47524944;
+const int PUBLISH_PERIOD = 20;
+
+struct SharedTraveler {
+						int32_t type;
+						int32_t row, col;
+						int32_t dir;
+						int32_t isLive;
+};
+
+//	what changes with every snapshot, besides the cells and travelers
+struct SharedGridState {
+						int32_t numTravelers;
+						int32_t numLiveTravelers;
+						int32_t redLevel, greenLevel, blueLevel;
+						int64_t numMoves;
+};
+
+struct SharedGridHeader {
+						//	set last, once the rest of the header is valid
+						std::atomic<uint32_t> magic;
+						int32_t numRows, numCols;
+						//	where the grid goes in the domain it is a strip of
+						//	(0 and numRows if it isn't part of one)
+						int32_t rowOffset, globalRows;
+						int32_t maxTravelers;
+						int32_t maxLevel;
+
+						alignas(64) std::atomic<uint32_t> seq;
+						SharedGridState state;
+};
+
+size_t sharedGridSize(int numRows, int numCols, int maxTravelers);
+SharedGridHeader* createSharedGrid(const char* name, int numRows, int numCols, int rowOffset, int globalRows,
+								   int maxTravelers, int maxLevel);
+SharedGridHeader* openSharedGrid(const char* name);
+void closeSharedGrid(SharedGridHeader* header, const char* name, bool unlinkName);
+
+int32_t* sharedGridCells(const SharedGridHeader* header);
+SharedTraveler* sharedGridTravelers(const SharedGridHeader* header);
+
+void beginSharedGridUpdate(SharedGridHeader* header);
+void endSharedGridUpdate(SharedGridHeader* header);
+//	copies the state, cells and travelers of a consistent snapshot
+bool readSharedGrid(const SharedGridHeader* header, SharedGridState& state, int32_t* cells, SharedTraveler* travelers);
+
+#endif // SHARED_GRID_H
@@ -0,0 +1,146 @@
+//
+//  zygote.cpp
+//
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+//
+#include "zygote.h"
+
+using namespace std;
+
+//---------------------------------------------------------------------------
+//  File-level global variables
+//---------------------------------------------------------------------------
+
+int zygoteListenFd = -1;
+//	connected clients and what came in after their last complete line
+map<int, string> zygoteClients;
+
+//	a request needs at least <num_cols> <num_rows> <num_threads> <pipe_name>
+const int MIN_ZYGOTE_ARGS = 4;
+
+//---------------------------------------------------------------------------
+//	Forking
+//---------------------------------------------------------------------------
+
+//	Forks a child running childMain on the request's arguments; returns the
+//	reply to send back
+static string forkChild(const string& line, int (*childMain)(int argc, char** argv))
+{
+	vector<string> args = {"travel"};
+	istringstream words(line);
+	string word;
+	while (words >> word)
+		args.push_back(word);
+	if ((int) args.size() - 1 < MIN_ZYGOTE_ARGS)
+		return "error expected <num_cols> <num_rows> <num_threads> <pipe_name> [options]\n";
+
+	const pid_t pid = fork();
+	if (pid < 0)
+		return string("error ") + strerror(errno) + "\n";
+	if (pid == 0)
+	{
+		//	none of the zygote's descriptors belong to the child
+		close(zygoteListenFd);
+		for (const auto& client : zygoteClients)
+			close(client.first);
+		signal(SIGCHLD, SIG_DFL);
+
+		vector<char*> argv;
+		for (string& arg : args)
+			argv.push_back(&arg[0]);
+		argv.push_back(nullptr);
+		exit(childMain(argv.size() - 1, argv.data()));
+	}
+	return to_string(pid) + "\n";
+}
+
+//---------------------------------------------------------------------------
+//	The loop
+//---------------------------------------------------------------------------
+
+int runZygote(const char* socketPath, int (*childMain)(int argc, char** argv))
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+	{
+		cerr << "Zygote socket path too long" << endl;
+		return 1;
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	zygoteListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socketPath);
+	if (zygoteListenFd < 0 || bind(zygoteListenFd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+		listen(zygoteListenFd, SOMAXCONN) != 0)
+	{
+		cerr << "Failed to open zygote socket " << socketPath << endl;
+		return 1;
+	}
+
+	//	nobody waits for the children here
+	signal(SIGCHLD, SIG_IGN);
+
+	vector<struct pollfd> polls;
+	while (true)
+	{
+		polls.clear();
+		polls.push_back({zygoteListenFd, POLLIN, 0});
+		for (const auto& client : zygoteClients)
+			polls.push_back({client.first, POLLIN, 0});
+		if (poll(polls.data(), polls.size(), -1) < 0)
+			continue;
+
+		for (const struct pollfd& p : polls)
+		{
+			if (p.revents == 0)
+				continue;
+			if (p.fd == zygoteListenFd)
+			{
+				const int clientFd = accept(zygoteListenFd, nullptr, nullptr);
+				if (clientFd >= 0)
+					zygoteClients[clientFd] = string();
+				continue;
+			}
+
+			char buffer[4096];
+			const ssize_t count = read(p.fd, buffer, sizeof(buffer));
+			if (count <= 0)
+			{
+				close(p.fd);
+				zygoteClients.erase(p.fd);
+				continue;
+			}
+			string& pending = zygoteClients[p.fd];
+			pending.append(buffer, count);
+
+			string replies;
+			size_t lineStart = 0, lineEnd;
+			while ((lineEnd = pending.find('\n', lineStart)) != string::npos)
+			{
+				replies += forkChild(pending.substr(lineStart, lineEnd - lineStart), childMain);
+				lineStart = lineEnd + 1;
+			}
+			pending.erase(0, lineStart);
+			if (!replies.empty() && send(p.fd, replies.data(), replies.size(), MSG_NOSIGNAL) < 0)
+			{
+				close(p.fd);
+				zygoteClients.erase(p.fd);
+			}
+		}
+	}
+}
@@ -0,0 +1,24 @@
+//
+//  zygote.h
+//
+
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+//-----------------------------------------------------------------------------
+//	Zygote mode: a travel process that has already paid for exec, dynamic
+//	linking and static initialization, and forks a copy of itself for each
+//	request on its Unix socket.  A request is one line holding the arguments
+//	of a travel command line (e.g. "40 40 8 /tmp/travpipe3 --headless"),
+//	which the child hands to childMain; the reply is the child's pid, or
+//	"error <reason>".
+//
+//	The zygote never starts threads (forking them would not carry them over)
+//	and never opens a window: a child that isn't headless initializes GLUT
+//	on its own.  Children are reaped by the system, their controller can
+//	watch them with a pidfd.
+//-----------------------------------------------------------------------------
+
+int runZygote(const char* socketPath, int (*childMain)(int argc, char** argv));
+
+#endif // ZYGOTE_H
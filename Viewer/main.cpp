@@ -0,0 +1,302 @@
+//
+//  main.cpp
+//  travel-viewer
+//
+
+// g++ -Wall -std=c++20 -I../Version2 main.cpp ../Version2/gl_frontEnd.cpp ../Version2/sharedGrid.cpp -framework OpenGL -framework GLUT -o travel-viewer
+
+ /*-------------------------------------------------------------------------+
+ |	Shows simulations published by Version2 travel processes.				|
+ |																			|
+ |	travel-viewer <name>... maps the shared snapshot of each process		|
+ |	started with --publish <name> (see sharedGrid.h), read-only, and		|
+ |	renders them all in one window, so that the processes themselves can	|
+ |	run headless.  The grids are placed left to right, one column apart,	|
+ |	except that consecutive strips of a domain go under one another and		|
+ |	show as the whole grid.  The state pane shows the live travelers of		|
+ |	all the simulations and their mean ink levels.							|
+ |																			|
+ |	The viewer only reads: the ink and speed keys do nothing here.			|
+ |		- 'ESC' --> exit the viewer											|
+ |		- left/right click in the grid --> zoom in/out						|
+ |		- drag in the grid --> pan, middle click --> whole grid				|
+ +-------------------------------------------------------------------------*/
+
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+#include <iostream>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+//
+#include "glPlatform.h"
+#include "gl_frontEnd.h"
+#include "sharedGrid.h"
+
+using namespace std;
+
+//==================================================================================
+//	Function prototypes
+//==================================================================================
+void displayGridPane(void);
+void displayStatePane(void);
+void placeSimulations(void);
+void viewerThreadFunc(void);
+
+//==================================================================================
+//	Global variables
+//==================================================================================
+
+struct Simulation {
+						std::string name;
+						SharedGridHeader* header;
+						//	where its grid goes in the combined one
+						int row0, col0;
+						//	its last consistent snapshot
+						SharedGridState state;
+						std::vector<int32_t> cells;
+						std::vector<SharedTraveler> travelers;
+};
+
+std::vector<Simulation> simulations;
+
+//	the combined grid and travelers, as the front end draws them
+int** grid;
+int num_rows = 0, num_cols = 0;
+vector<TravelerInfo> travelerList;
+int numLiveTravelers = 0;
+int redLevel = 0, greenLevel = 0, blueLevel = 0;
+std::mutex gridLock;
+
+//	columns left dark between two simulations
+const int GRID_GAP = 1;
+//	a snapshot is being written more often than not after that many tries
+const int MAX_READ_TRIES = 3;
+
+std::thread viewerThread;
+std::atomic<bool> stopViewer(false);
+
+//	the front end's windows
+extern int	GRID_PANE, STATE_PANE;
+extern int	gMainWindow, gSubwindow[2];
+
+//	what the front end expects from the program
+bool DRAW_COLORED_TRAVELER_HEADS = true;
+int MAX_FPS = 100;
+int MAX_LEVEL = 50;
+int MAX_ADD_INK = 10;
+
+//==================================================================================
+//	Main
+//==================================================================================
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <name>...\n";
+		return 1;
+	}
+
+	//	wait for the simulations that haven't published yet
+	for (int k = 1; k < argc; k++)
+	{
+		Simulation simulation;
+		simulation.name = argv[k];
+		bool waiting = false;
+		while ((simulation.header = openSharedGrid(simulation.name.c_str())) == nullptr)
+		{
+			if (!waiting)
+				std::cout << "waiting for " << simulation.name << std::endl;
+			waiting = true;
+			usleep(100000);
+		}
+		simulations.push_back(simulation);
+	}
+	placeSimulations();
+	MAX_LEVEL = simulations[0].header->maxLevel;
+
+	grid = new int*[num_rows];
+	for (int i = 0; i < num_rows; i++)
+	{
+		grid[i] = new int[num_cols];
+		for (int j = 0; j < num_cols; j++)
+			grid[i][j] = 0xFF000000;
+	}
+
+	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+	initializeGridRendering(grid, num_rows, num_cols);
+	viewerThread = std::thread(viewerThreadFunc);
+
+	glutMainLoop();
+	cleanupAndQuit();
+	return 0;
+}
+
+// left to right, except that a strip of a domain goes right under the strip
+// before it
+void placeSimulations(void)
+{
+	for (size_t k = 0; k < simulations.size(); k++)
+	{
+		Simulation& simulation = simulations[k];
+		const SharedGridHeader* header = simulation.header;
+		const SharedGridHeader* previous = k > 0 ? simulations[k - 1].header : nullptr;
+
+		if (previous != nullptr && header->rowOffset > 0 && previous->numCols == header->numCols
+			&& previous->globalRows == header->globalRows && previous->rowOffset + previous->numRows == header->rowOffset)
+			simulation.col0 = simulations[k - 1].col0;
+		else
+			simulation.col0 = k == 0 ? 0 : num_cols + GRID_GAP;
+		simulation.row0 = header->rowOffset;
+		num_rows = std::max(num_rows, simulation.row0 + header->numRows);
+		num_cols = std::max(num_cols, simulation.col0 + header->numCols);
+
+		simulation.state = SharedGridState();
+		simulation.cells.assign(header->numRows * header->numCols, 0xFF000000);
+		simulation.travelers.resize(header->maxTravelers);
+	}
+}
+
+// copy the latest snapshot of every simulation into the combined grid and
+// traveler list, and mark what changed for the renderer
+void viewerThreadFunc(void)
+{
+	std::vector<int32_t> cells;
+	std::vector<SharedTraveler> travelers;
+	std::vector<TravelerInfo> combinedTravelers;
+	while (!stopViewer)
+	{
+		bool changed = false;
+		for (Simulation& simulation : simulations)
+		{
+			cells.resize(simulation.cells.size());
+			travelers.resize(simulation.travelers.size());
+			SharedGridState state;
+			for (int tries = 0; tries < MAX_READ_TRIES; tries++)
+			{
+				if (readSharedGrid(simulation.header, state, cells.data(), travelers.data()))
+				{
+					changed = changed || state.numMoves != simulation.state.numMoves
+								|| state.numLiveTravelers != simulation.state.numLiveTravelers
+								|| state.redLevel != simulation.state.redLevel || state.greenLevel != simulation.state.greenLevel
+								|| state.blueLevel != simulation.state.blueLevel;
+					simulation.state = state;
+					simulation.cells.swap(cells);
+					simulation.travelers.swap(travelers);
+					break;
+				}
+			}
+		}
+
+		combinedTravelers.clear();
+		int numLive = 0, red = 0, green = 0, blue = 0;
+		for (const Simulation& simulation : simulations)
+		{
+			for (int k = 0; k < simulation.state.numTravelers; k++)
+			{
+				const SharedTraveler& shared = simulation.travelers[k];
+				TravelerInfo traveler;
+				traveler.type = static_cast<TravelerType>(shared.type);
+				traveler.row = shared.row + simulation.row0;
+				traveler.col = shared.col + simulation.col0;
+				traveler.dir = static_cast<TravelDirection>(shared.dir);
+				traveler.isLive = shared.isLive != 0;
+				combinedTravelers.push_back(traveler);
+			}
+			numLive += simulation.state.numLiveTravelers;
+			red += simulation.state.redLevel;
+			green += simulation.state.greenLevel;
+			blue += simulation.state.blueLevel;
+		}
+
+		gridLock.lock();
+		for (const Simulation& simulation : simulations)
+		{
+			const int numRows = simulation.header->numRows, numCols = simulation.header->numCols;
+			for (int i = 0; i < numRows; i++)
+				for (int j = 0; j < numCols; j++)
+				{
+					int& cell = grid[simulation.row0 + i][simulation.col0 + j];
+					if (cell != simulation.cells[i * numCols + j])
+					{
+						cell = simulation.cells[i * numCols + j];
+						markGridCellDirty(simulation.row0 + i, simulation.col0 + j);
+						changed = true;
+					}
+				}
+		}
+		travelerList.swap(combinedTravelers);
+		numLiveTravelers = numLive;
+		redLevel = red / (int) simulations.size();
+		greenLevel = green / (int) simulations.size();
+		blueLevel = blue / (int) simulations.size();
+		gridLock.unlock();
+
+		if (changed)
+			markSimulationChanged();
+		usleep(PUBLISH_PERIOD * 1000);
+	}
+}
+
+//==================================================================================
+//	Front end callbacks
+//==================================================================================
+
+void displayGridPane(void)
+{
+	glutSetWindow(gSubwindow[GRID_PANE]);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	gridLock.lock();
+	drawGridAndTravelers(travelerList);
+	gridLock.unlock();
+
+	glutSwapBuffers();
+	glutSetWindow(gMainWindow);
+}
+
+void displayStatePane(void)
+{
+	glutSetWindow(gSubwindow[STATE_PANE]);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	gridLock.lock();
+	drawState(numLiveTravelers, redLevel, greenLevel, blueLevel);
+	gridLock.unlock();
+
+	glutSwapBuffers();
+	glutSetWindow(gMainWindow);
+}
+
+void cleanupAndQuit()
+{
+	stopViewer = true;
+	if (viewerThread.joinable())
+		viewerThread.join();
+	for (Simulation& simulation : simulations)
+		closeSharedGrid(simulation.header, simulation.name.c_str(), false);
+	for (int i = 0; i < num_rows; i++)
+		delete []grid[i];
+	delete []grid;
+	exit(0);
+}
+
+//	The viewer can't change the simulations
+bool requestRefill(TravelerType, int) { return false; }
+void faster() {}
+void slower() {}
+void speedupProducers() {}
+void slowdownProducers() {}
+
+char getProcessIndex()
+{
+	return 'V';
+}